@@ -39,6 +39,10 @@ func checkArgs(args [][]byte, conn *websocket.Conn) {
 }
 
 const maxRequestBytes int64 = 1 << 16
+const maxTimeoutMs = 60 * 1000
+const maxInstructionLimit int64 = 1e18 - 1
+const maxRuns = 1000
+const maxTimelineIntervalMs = 1000
 
 func handleWs(w http.ResponseWriter, r *http.Request) {
 	conn, err := upgrader.Upgrade(w, r, nil)
@@ -90,9 +94,42 @@ func handleWs(w http.ResponseWriter, r *http.Request) {
 		return
 	}
 
-	if invocation.Timeout <= 0 || invocation.Timeout > 60 {
-		log.Println("unacceptable timeout:", invocation.Timeout)
-		closeConnection(conn, websocket.ClosePolicyViolation, "timeout not in range (0, 60]")
+	if invocation.TimeoutMs == 0 {
+		invocation.TimeoutMs = invocation.Timeout * 1000
+	}
+	if invocation.TimeoutMs <= 0 || invocation.TimeoutMs > maxTimeoutMs {
+		log.Println("unacceptable timeout:", invocation.TimeoutMs)
+		closeConnection(conn, websocket.ClosePolicyViolation, "timeout not in range (0, 60] seconds")
+		return
+	}
+
+	if invocation.CpuTimeMs < 0 || invocation.CpuTimeMs > maxTimeoutMs {
+		log.Println("unacceptable CPU time limit:", invocation.CpuTimeMs)
+		closeConnection(conn, websocket.ClosePolicyViolation, "CPU time limit not in range [0, 60] seconds")
+		return
+	}
+
+	if invocation.InstructionLimit < 0 || invocation.InstructionLimit > maxInstructionLimit {
+		log.Println("unacceptable instruction limit:", invocation.InstructionLimit)
+		closeConnection(conn, websocket.ClosePolicyViolation, "instruction limit out of range")
+		return
+	}
+
+	if invocation.Runs < 0 || invocation.Runs > maxRuns || invocation.WarmupRuns < 0 || invocation.WarmupRuns > maxRuns {
+		log.Println("unacceptable number of runs:", invocation.Runs, invocation.WarmupRuns)
+		closeConnection(conn, websocket.ClosePolicyViolation, "number of runs not in range [0, 1000]")
+		return
+	}
+
+	if invocation.RunBudgetMs < 0 || invocation.RunBudgetMs > maxTimeoutMs {
+		log.Println("unacceptable run budget:", invocation.RunBudgetMs)
+		closeConnection(conn, websocket.ClosePolicyViolation, "run budget not in range [0, 60] seconds")
+		return
+	}
+
+	if invocation.TimelineIntervalMs < 0 || invocation.TimelineIntervalMs > maxTimelineIntervalMs {
+		log.Println("unacceptable timeline interval:", invocation.TimelineIntervalMs)
+		closeConnection(conn, websocket.ClosePolicyViolation, "timeline interval not in range [0, 1000] milliseconds")
 		return
 	}
 
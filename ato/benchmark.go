@@ -0,0 +1,299 @@
+package ato
+
+import (
+	"bufio"
+	"encoding/json"
+	"flag"
+	"log"
+	"math"
+	"os"
+	"path"
+	"sort"
+	"strconv"
+	"strings"
+	"time"
+)
+
+const cacheDir = "/usr/local/lib/ATO/cache"
+
+type distribution struct {
+	Min  int64 `json:"min"`
+	P50  int64 `json:"p50"`
+	P99  int64 `json:"p99"`
+	Max  int64 `json:"max"`
+	Mean int64 `json:"mean"`
+}
+
+func summarise(samples []int64) distribution {
+	if len(samples) == 0 {
+		return distribution{}
+	}
+	sorted := append([]int64(nil), samples...)
+	sort.Slice(sorted, func(i, j int) bool { return sorted[i] < sorted[j] })
+	percentile := func(p float64) int64 {
+		return sorted[int(math.Ceil(p*float64(len(sorted))))-1]
+	}
+	var sum int64
+	for _, s := range sorted {
+		sum += s
+	}
+	return distribution{
+		Min:  sorted[0],
+		P50:  percentile(0.5),
+		P99:  percentile(0.99),
+		Max:  sorted[len(sorted)-1],
+		Mean: sum / int64(len(sorted)),
+	}
+}
+
+// The layers between the API server starting an invocation and the program getting control, worked out from the
+// trace. Each is skipped if it can't be found in the trace, for example because the runner doesn't use yargs.
+var layers = []string{
+	// the sandbox launcher, up to exec'ing bwrap
+	"sandbox",
+	// bwrap setting up the namespaces and mounts, up to the wrapper starting
+	"bwrap",
+	// the wrapper setting up its limits and measurements, forking, and exec'ing the runner
+	"wrapper",
+	// the runner (a shell, or the engine) up to its first exec
+	"runner",
+	// every yargs, from its exec to the exec of its program
+	"yargs",
+	// the first program the runner starts (the compiler, for a compiled language), from its exec to its exit; for a
+	// no-op program, this is the start-up time of the interpreter
+	"program",
+	// everything else: the API server writing the files, starting the launcher and reading the results, and all the
+	// processes exiting
+	"rest",
+}
+
+// breakDown splits the total time of an invocation into its layers, using the trace of the invocation.
+func breakDown(total int64, trace *sandboxTrace) map[string]int64 {
+	times := map[string]int64{}
+	if trace == nil {
+		return times
+	}
+	times["sandbox"] = trace.BwrapExec - trace.LauncherStart
+	times["bwrap"] = trace.WrapperStart - trace.BwrapExec
+	var execs []traceEvent
+	for _, event := range trace.Events {
+		if event.Type == "exec" {
+			execs = append(execs, event)
+		}
+	}
+	if len(execs) > 0 && execs[0].Comm == "runner" {
+		times["wrapper"] = execs[0].Time - trace.WrapperStart
+		if len(execs) > 1 {
+			times["runner"] = execs[1].Time - execs[0].Time
+		}
+	}
+	for i, event := range execs {
+		if event.Comm == "yargs" {
+			for _, next := range execs[i+1:] {
+				if next.Pid == event.Pid {
+					times["yargs"] += next.Time - event.Time
+					break
+				}
+			}
+		}
+	}
+	for i, event := range execs {
+		if i == 0 || event.Comm == "runner" || event.Comm == "yargs" {
+			continue
+		}
+		for _, exit := range trace.Events {
+			if exit.Type == "exit" && exit.Pid == event.Pid && exit.Time > event.Time {
+				times["program"] = exit.Time - event.Time
+				break
+			}
+		}
+		break
+	}
+	times["rest"] = total
+	for layer, duration := range times {
+		if layer != "rest" {
+			times["rest"] -= duration
+		}
+	}
+	return times
+}
+
+type benchmarkReport struct {
+	Sandbox string `json:"sandbox"`
+	// whether the sandbox was run as the old zsh script
+	Legacy   bool   `json:"legacy"`
+	Language string `json:"language"`
+	// "spec" if the language was run by the engine, or "script" if by its runner script
+	Runner string `json:"runner"`
+	// whether the language's cache was used (if it has one)
+	Cached bool `json:"cached"`
+	Runs   int  `json:"runs"`
+	// invocations where the program didn't exit successfully, for example because it doesn't compile
+	Failures int `json:"failures"`
+	// wall-clock time of the whole invocation, as seen by the API server
+	Total distribution `json:"total"`
+	// time spent in the runner, including starting it and compiling, as measured by the wrapper
+	Real distribution `json:"real"`
+	// time spent outside the runner: sandbox setup, bwrap, wrapper, and cleanup
+	Overhead distribution `json:"overhead"`
+	// time spent in each layer, as far as it could be traced
+	Layers map[string]distribution `json:"layers"`
+	// time spent compiling, for languages which mark their phases
+	Compile *distribution `json:"compile"`
+	// time taken to import each package installed in the image, slowest first, for languages whose cache records it
+	Imports []importTime `json:"imports,omitempty"`
+}
+
+type importTime struct {
+	Module string `json:"module"`
+	Time   int64  `json:"time"`
+}
+
+// readImportTimes reads the import profile recorded when the language's cache was warmed, if there is one: a module
+// name and the time to import it in microseconds on each line.
+func readImportTimes(language string) []importTime {
+	file, err := os.Open(path.Join(cacheDir, language, "importtime.txt"))
+	if err != nil {
+		return nil
+	}
+	defer file.Close()
+	var times []importTime
+	scanner := bufio.NewScanner(file)
+	for scanner.Scan() {
+		fields := strings.Fields(scanner.Text())
+		if len(fields) != 2 {
+			continue
+		}
+		if microseconds, err := strconv.ParseInt(fields[1], 10, 64); err == nil {
+			times = append(times, importTime{fields[0], microseconds * 1000})
+		}
+	}
+	return times
+}
+
+type benchmarkOptions struct {
+	runs     int
+	uncached bool
+	legacy   bool
+}
+
+func benchmark(options benchmarkOptions, language string, code []byte, script bool) benchmarkReport {
+	inv := invocation{
+		Language:  language,
+		Code:      code,
+		TimeoutMs: maxTimeoutMs,
+		script:    script,
+		trace:     !options.legacy,
+		uncached:  options.uncached,
+		legacy:    options.legacy,
+	}
+	total := make([]int64, 0, options.runs)
+	realTime := make([]int64, 0, options.runs)
+	overhead := make([]int64, 0, options.runs)
+	layerTimes := map[string][]int64{}
+	var compile []int64
+	failures := 0
+	for i := 0; i < options.runs; i++ {
+		start := time.Now()
+		result, err := inv.invoke()
+		if err != nil {
+			log.Fatal("invocation error: ", err)
+		}
+		elapsed := time.Since(start).Nanoseconds()
+		total = append(total, elapsed)
+		realTime = append(realTime, result.Real)
+		overhead = append(overhead, elapsed-result.Real)
+		for layer, duration := range breakDown(elapsed, result.Trace) {
+			layerTimes[layer] = append(layerTimes[layer], duration)
+		}
+		for _, phase := range result.Phases {
+			if phase.Name == "compile" {
+				compile = append(compile, phase.Real)
+			}
+		}
+		if result.StatusType != "exited" || result.StatusValue != 0 {
+			failures++
+		}
+	}
+	runner := "spec"
+	if script || options.legacy {
+		runner = "script"
+	}
+	report := benchmarkReport{
+		Sandbox:  sandboxPath,
+		Legacy:   options.legacy,
+		Language: language,
+		Runner:   runner,
+		Cached:   !options.uncached && !options.legacy,
+		Runs:     options.runs,
+		Failures: failures,
+		Total:    summarise(total),
+		Real:     summarise(realTime),
+		Overhead: summarise(overhead),
+		Layers:   map[string]distribution{},
+		Imports:  readImportTimes(language),
+	}
+	for _, layer := range layers {
+		if times, exists := layerTimes[layer]; exists {
+			report.Layers[layer] = summarise(times)
+		}
+	}
+	if len(compile) > 0 {
+		distribution := summarise(compile)
+		report.Compile = &distribution
+	}
+	return report
+}
+
+// BenchmarkMain measures the per-request cost of the sandbox by running the same trivial program many times through
+// the real invocation path, and breaks it down into the time taken by each layer. It must be run on an installed
+// system as the ato user.
+func BenchmarkMain() {
+	flags := flag.NewFlagSet(os.Args[0], flag.ExitOnError)
+	languageList := flags.String("language", "zsh", "comma-separated languages to benchmark, or all")
+	codeString := flags.String("code", "", "program to run")
+	codeFile := flags.String("code-file", "", "file containing the program to run, instead of -code")
+	compareRunners := flags.Bool("compare-runners", false,
+		"also run each language with its runner script, to measure the startup saved by its spec")
+	var options benchmarkOptions
+	flags.IntVar(&options.runs, "runs", 100, "number of invocations")
+	flags.BoolVar(&options.uncached, "uncached", false, "run without the languages' caches")
+	flags.StringVar(&sandboxPath, "sandbox", sandboxPath, "path to the sandbox launcher")
+	flags.BoolVar(&options.legacy, "legacy", false,
+		"the sandbox is the old zsh script, which only takes the invocation ID, language, timeout in seconds and image")
+	flags.Parse(os.Args[1:])
+	var languages []string
+	if *languageList == "all" {
+		for language := range Languages {
+			languages = append(languages, language)
+		}
+		sort.Strings(languages)
+	} else {
+		languages = strings.Split(*languageList, ",")
+	}
+	for _, language := range languages {
+		if _, exists := Languages[language]; !exists {
+			log.Fatal("no such language: ", language)
+		}
+	}
+	code := []byte(*codeString)
+	if *codeFile != "" {
+		var err error
+		if code, err = os.ReadFile(*codeFile); err != nil {
+			log.Fatal(err)
+		}
+	}
+	reports := []benchmarkReport{}
+	for _, language := range languages {
+		// without a spec, the launcher uses the runner script anyway
+		reports = append(reports, benchmark(options, language, code, false))
+		if *compareRunners && !options.legacy {
+			reports = append(reports, benchmark(options, language, code, true))
+		}
+	}
+	encoder := json.NewEncoder(os.Stdout)
+	encoder.SetIndent("", "  ")
+	if err := encoder.Encode(reports); err != nil {
+		log.Fatal(err)
+	}
+}
@@ -22,8 +22,33 @@ type invocation struct {
 	Arguments [][]byte `msgpack:"arguments"`
 	Options   [][]byte `msgpack:"options"`
 	Timeout   int      `msgpack:"timeout"`
+	TimeoutMs int      `msgpack:"timeout_ms"`
+	CpuTimeMs int      `msgpack:"cpu_time_ms"`
+	// maximum number of instructions, or 0 for no limit
+	InstructionLimit int64 `msgpack:"instruction_limit"`
+	// number of times to run the program, for benchmarking; 0 means once, or as many as fit in RunBudgetMs
+	Runs int `msgpack:"runs"`
+	// number of extra runs before the measured ones
+	WarmupRuns int `msgpack:"warmup_runs"`
+	// stop starting new runs after this long, or 0 for no such budget
+	RunBudgetMs int `msgpack:"run_budget_ms"`
+	// whether to profile the program
+	Profile bool `msgpack:"profile"`
+	// interval between samples of the timeline, or 0 for no timeline
+	TimelineIntervalMs int `msgpack:"timeline_interval_ms"`
+	// use the runner script even if the language has a spec; only the benchmark sets this
+	script bool
+	// trace the layers of the sandbox; only the benchmark sets this
+	trace bool
+	// don't mount the language's cache; only the benchmark sets this
+	uncached bool
+	// call the sandbox the way the old zsh script expected, to compare it with the launcher; only the benchmark sets this
+	legacy bool
 }
 
+// only the benchmark changes this
+var sandboxPath = "/usr/local/bin/ATO_sandbox"
+
 func write(dir string, name string, data []byte) error {
 	if file, err := os.Create(path.Join(dir, name)); err == nil {
 		defer file.Close()
@@ -56,24 +81,138 @@ func nullTerminate(args [][]byte) []byte {
 	return buf.Bytes()
 }
 
+type statistics struct {
+	Min    int64 `json:"min" msgpack:"min"`
+	Median int64 `json:"median" msgpack:"median"`
+	Mean   int64 `json:"mean" msgpack:"mean"`
+	P95    int64 `json:"p95" msgpack:"p95"`
+	Stddev int64 `json:"stddev" msgpack:"stddev"`
+}
+
+type runStatistics struct {
+	Runs         int         `json:"runs" msgpack:"runs"`
+	WarmupRuns   int         `json:"warmup_runs" msgpack:"warmup_runs"`
+	Real         *statistics `json:"real" msgpack:"real"`
+	User         *statistics `json:"user" msgpack:"user"`
+	Kernel       *statistics `json:"kernel" msgpack:"kernel"`
+	Instructions *statistics `json:"instructions" msgpack:"instructions"`
+	SpawnLatency *statistics `json:"spawn_latency" msgpack:"spawn_latency"`
+}
+
+type phase struct {
+	Name   string `json:"name" msgpack:"name"`
+	Real   int64  `json:"real" msgpack:"real"`
+	User   int64  `json:"user" msgpack:"user"`
+	Kernel int64  `json:"kernel" msgpack:"kernel"`
+	// nil if the server's CPU doesn't expose it
+	Instructions    *int64 `json:"instructions" msgpack:"instructions"`
+	MajorPageFaults int64  `json:"major_page_faults" msgpack:"major_page_faults"`
+	MinorPageFaults int64  `json:"minor_page_faults" msgpack:"minor_page_faults"`
+	// nil if the server's kernel can't reset the cgroup's peak memory usage
+	MaxMem *int64 `json:"max_mem" msgpack:"max_mem"`
+}
+
+type traceEvent struct {
+	Time   int64  `json:"time"`
+	Type   string `json:"type"`
+	Pid    int    `json:"pid"`
+	Parent int    `json:"parent"`
+	Comm   string `json:"comm"`
+}
+
+// times on the host's monotonic clock, in nanoseconds
+type sandboxTrace struct {
+	LauncherStart int64 `json:"launcher_start"`
+	BwrapExec     int64 `json:"bwrap_exec"`
+	WrapperStart  int64 `json:"wrapper_start"`
+	Lost          int64 `json:"lost"`
+	// forks, execs and exits of the process tree, or nil if they couldn't be traced
+	Events []traceEvent `json:"events"`
+}
+
 type result struct {
 	Stdout          []byte `json:"-" msgpack:"stdout"`
 	Stderr          []byte `json:"-" msgpack:"stderr"`
 	StdoutTruncated bool   `json:"-" msgpack:"stdout_truncated"`
 	StderrTruncated bool   `json:"-" msgpack:"stderr_truncated"`
+	// folded stacks from the profiler, if requested
+	Profile         []byte `json:"-" msgpack:"profile"`
 	StatusType      string `json:"status_type" msgpack:"status_type"`
 	StatusValue     int    `json:"status_value" msgpack:"status_value"`
 	TimedOut        bool   `json:"timed_out" msgpack:"timed_out"`
+	Limit           string `json:"limit" msgpack:"limit"`
 	Real            int64  `json:"real" msgpack:"real"`
 	Kernel          int64  `json:"kernel" msgpack:"kernel"`
 	User            int64  `json:"user" msgpack:"user"`
 	MaxMem          int64  `json:"max_mem" msgpack:"max_mem"`
 	Waits           int64  `json:"waits" msgpack:"waits"`
 	Preemptions     int64  `json:"preemptions" msgpack:"preemptions"`
+	SpawnLatency    int64  `json:"spawn_latency" msgpack:"spawn_latency"`
 	MajorPageFaults int64  `json:"minor_page_faults" msgpack:"minor_page_faults"`
 	MinorPageFaults int64  `json:"major_page_faults" msgpack:"major_page_faults"`
 	InputOps        int64  `json:"input_ops" msgpack:"input_ops"`
 	OutputOps       int64  `json:"output_ops" msgpack:"output_ops"`
+	// a requested limit which the server couldn't enforce, if any
+	LimitUnavailable *string `json:"limit_unavailable" msgpack:"limit_unavailable"`
+	// from the invocation's cgroup, nil if the server's cgroups don't provide them
+	ReadBytes  *int64 `json:"read_bytes" msgpack:"read_bytes"`
+	WriteBytes *int64 `json:"write_bytes" msgpack:"write_bytes"`
+	OomKills   *int64 `json:"oom_kills" msgpack:"oom_kills"`
+	MemoryHigh *int64 `json:"memory_high_events" msgpack:"memory_high_events"`
+	MemoryMax  *int64 `json:"memory_max_events" msgpack:"memory_max_events"`
+	// performance counters, nil if the server doesn't support them
+	Instructions    *int64 `json:"instructions" msgpack:"instructions"`
+	Cycles          *int64 `json:"cycles" msgpack:"cycles"`
+	L1DMisses       *int64 `json:"l1d_misses" msgpack:"l1d_misses"`
+	LLCMisses       *int64 `json:"llc_misses" msgpack:"llc_misses"`
+	BranchMisses    *int64 `json:"branch_misses" msgpack:"branch_misses"`
+	TaskClock       *int64 `json:"task_clock" msgpack:"task_clock"`
+	ContextSwitches *int64 `json:"context_switches" msgpack:"context_switches"`
+	PageFaults      *int64 `json:"page_faults" msgpack:"page_faults"`
+	// only present if the runner marked its phases
+	Phases []phase `json:"phases" msgpack:"phases"`
+	// [time, memory, CPU time, processes], each nil if it couldn't be read, only present if requested
+	Timeline [][4]*int64 `json:"timeline" msgpack:"timeline"`
+	// only present if the program was run more than once
+	RunStatistics *runStatistics `json:"run_statistics" msgpack:"run_statistics"`
+	// only present if tracing was requested, which the API doesn't allow
+	Trace *sandboxTrace `json:"trace" msgpack:"-"`
+}
+
+// sandboxOptions returns the options for the sandbox launcher (see sandbox.c) which this invocation needs.
+func (invocation invocation) sandboxOptions() []string {
+	var args []string
+	if invocation.CpuTimeMs != 0 {
+		args = append(args, "-c", strconv.Itoa(invocation.CpuTimeMs))
+	}
+	if invocation.InstructionLimit != 0 {
+		args = append(args, "-i", strconv.FormatInt(invocation.InstructionLimit, 10))
+	}
+	if invocation.Runs != 0 {
+		args = append(args, "-n", strconv.Itoa(invocation.Runs))
+	}
+	if invocation.WarmupRuns != 0 {
+		args = append(args, "-w", strconv.Itoa(invocation.WarmupRuns))
+	}
+	if invocation.RunBudgetMs != 0 {
+		args = append(args, "-b", strconv.Itoa(invocation.RunBudgetMs))
+	}
+	if invocation.Profile {
+		args = append(args, "-p")
+	}
+	if invocation.script {
+		args = append(args, "-s")
+	}
+	if invocation.uncached {
+		args = append(args, "-u")
+	}
+	if invocation.trace {
+		args = append(args, "-x")
+	}
+	if invocation.TimelineIntervalMs != 0 {
+		args = append(args, "-t", strconv.Itoa(invocation.TimelineIntervalMs))
+	}
+	return args
 }
 
 func (invocation invocation) invoke() (*result, error) {
@@ -105,13 +244,21 @@ func (invocation invocation) invoke() (*result, error) {
 		return nil, err
 	}
 
-	cmd := exec.Command(
-		"/usr/local/bin/ATO_sandbox",
+	var args []string
+	timeout := strconv.Itoa(invocation.TimeoutMs)
+	if invocation.legacy {
+		// the script took the timeout in whole seconds, and none of the options
+		timeout = strconv.Itoa((invocation.TimeoutMs + 999) / 1000)
+	} else {
+		args = invocation.sandboxOptions()
+	}
+	args = append(args,
 		unhashedInvocationId,
 		invocation.Language,
-		strconv.Itoa(invocation.Timeout),
+		timeout,
 		Languages[invocation.Language].Image,
 	)
+	cmd := exec.Command(sandboxPath, args...)
 	cmd.Env = []string{"PATH=" + os.Getenv("PATH")}
 	cmd.Stdin = nil
 
@@ -180,5 +327,12 @@ func (invocation invocation) invoke() (*result, error) {
 		return nil, err
 	}
 
+	if invocation.Profile {
+		// the wrapper limits the size of the profile
+		if result.Profile, err = os.ReadFile(path.Join(dir, "profile")); err != nil {
+			return nil, err
+		}
+	}
+
 	return &result, nil
 }
@@ -0,0 +1,30 @@
+package ato
+
+import (
+	"encoding/json"
+	"testing"
+)
+
+// The wrapper writes null for a timeline value it couldn't read, which mustn't turn into a real zero.
+func TestTimelineNullSample(t *testing.T) {
+	status := `{"timeline":[[0,2048,0,3],[1000000,null,null,null]]}`
+	var result result
+	if err := json.Unmarshal([]byte(status), &result); err != nil {
+		t.Fatal(err)
+	}
+	if len(result.Timeline) != 2 {
+		t.Fatalf("got %d samples, want 2", len(result.Timeline))
+	}
+	first, second := result.Timeline[0], result.Timeline[1]
+	if first[1] == nil || *first[1] != 2048 || first[2] == nil || *first[2] != 0 {
+		t.Errorf("first sample: got memory %v and CPU time %v, want 2048 and 0", first[1], first[2])
+	}
+	if second[0] == nil || *second[0] != 1000000 {
+		t.Errorf("second sample: got time %v, want 1000000", second[0])
+	}
+	for i, value := range second[1:] {
+		if value != nil {
+			t.Errorf("second sample: got %d for value %d, want nil", *value, i+1)
+		}
+	}
+}
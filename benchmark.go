@@ -0,0 +1,9 @@
+package main
+
+import (
+	"github.com/attempt-this-online/attempt-this-online/ato"
+)
+
+func main() {
+	ato.BenchmarkMain()
+}
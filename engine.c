@@ -0,0 +1,344 @@
+/* engine -- compile and run a program from a declarative language spec, without a shell
+
+   Usage: engine [SPEC]
+
+   The spec (by default /ATO/spec) describes a language in terms of a few steps, one per line, which are carried out
+   in order. Words are separated by spaces, and there is no quoting; lines starting with # are comments.
+
+       cd DIR                          change the working directory
+       mkdir DIR...                    create directories, unless they already exist
+       symlink TARGET NAME             create a symbolic link, unless NAME already exists
+       env NAME=VALUE...               set environment variables
+       compile [>&2] PROGRAM [ARGS...] run a command, and stop with its status if it fails
+       run [>&2] PROGRAM [ARGS...]     replace the engine with the program, reading from /ATO/input
+
+   In the arguments of compile and run, the words %options and %arguments are replaced by the null-terminated
+   arguments in /ATO/options and /ATO/arguments. Similarly, a word %PATH, where PATH is absolute, is replaced by the
+   arguments in that file, or by nothing if it doesn't exist; this is for options worked out when the language's cache
+   was warmed. >&2 sends the command's standard output to standard error. If any compile steps have run, the run phase
+   is marked on the phase pipe before the program is started.
+
+   This does what a simple runner script does, but saves starting a shell and a separate yargs process, so it is used in
+   preference to the runner script when a language has a spec.  */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#define SPEC_PATH "/ATO/spec"
+#define INPUT_PATH "/ATO/input"
+// pipe to the wrapper, on which the runner marks phases
+#define PHASE_FD 3
+// %options, %arguments, and any %PATH words
+#define MAX_ARGUMENT_FILES 8
+
+struct argument_file {
+    char * marker;
+    char * file_name;
+    char * file_buf;
+    size_t file_size;
+    size_t arg_count;
+    bool mapped;
+    // whether the file not existing means no arguments, rather than an error
+    bool optional;
+};
+
+static struct argument_file argument_files [MAX_ARGUMENT_FILES] = {
+    { "%options", "/ATO/options" },
+    { "%arguments", "/ATO/arguments" },
+};
+static size_t argument_file_count = 2;
+
+static char * spec_path = SPEC_PATH;
+static size_t line_number = 0;
+
+// map the whole of the file into argument_file->file_buf, and count the arguments in it, the first time it is used
+int map_argument_file(struct argument_file * argument_file) {
+    if (argument_file->mapped) {
+        return 0;
+    };
+    int fd = openat(AT_FDCWD, argument_file->file_name, O_RDONLY | O_CLOEXEC);
+    if (fd < 0 && errno == ENOENT && argument_file->optional) {
+        argument_file->mapped = true;
+        return 0;
+    } else if (fd < 0) {
+        perror("engine: openat");
+        return -1;
+    };
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        perror("engine: fstat");
+        return -1;
+    };
+    argument_file->file_size = st.st_size;
+    if (argument_file->file_size != 0) {
+        argument_file->file_buf = mmap(NULL, argument_file->file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (argument_file->file_buf == MAP_FAILED) {
+            perror("engine: mmap");
+            return -1;
+        };
+    };
+    close(fd);
+    char * end = argument_file->file_buf + argument_file->file_size;
+    for (char * p = argument_file->file_buf; p < end; p++) {
+        p = memchr(p, 0, end - p);
+        if (p == NULL) {
+            // the last string is ignored
+            fprintf(stderr, "%s\n", "engine: string was not null-terminated!");
+            break;
+        };
+        argument_file->arg_count++;
+    };
+    argument_file->mapped = true;
+    return 0;
+};
+
+// the argument file a word refers to, if any, adding one for a %PATH word the first time it is seen
+struct argument_file * find_argument_file(char * word) {
+    for (size_t i = 0; i < argument_file_count; i++) {
+        if (strcmp(word, argument_files[i].marker) == 0) {
+            return &argument_files[i];
+        };
+    };
+    if (strncmp(word, "%/", 2) != 0) {
+        return NULL;
+    } else if (argument_file_count == MAX_ARGUMENT_FILES) {
+        fprintf(stderr, "engine: too many argument files to substitute %s\n", word);
+        return NULL;
+    };
+    struct argument_file * argument_file = &argument_files[argument_file_count++];
+    argument_file->marker = word;
+    argument_file->file_name = word + 1;
+    argument_file->optional = true;
+    return argument_file;
+};
+
+// build a null-terminated argument array from the words of a step, substituting in the argument files
+char * * build_argv(char * * words, size_t word_count) {
+    // the words, plus the terminating null pointer
+    size_t args_buffer_size = word_count + 1;
+    for (size_t i = 0; i < word_count; i++) {
+        struct argument_file * argument_file = find_argument_file(words[i]);
+        if (argument_file != NULL) {
+            if (map_argument_file(argument_file) < 0) {
+                return NULL;
+            };
+            args_buffer_size += argument_file->arg_count;
+        };
+    };
+    char * * args_buffer = malloc(args_buffer_size * sizeof *args_buffer);
+    if (args_buffer == NULL) {
+        perror("engine: malloc");
+        return NULL;
+    };
+    size_t args_length = 0;
+    for (size_t i = 0; i < word_count; i++) {
+        struct argument_file * argument_file = find_argument_file(words[i]);
+        if (argument_file != NULL) {
+            char * arg = argument_file->file_buf;
+            for (size_t n = 0; n < argument_file->arg_count; n++) {
+                args_buffer[args_length++] = arg;
+                // null-termination = end of string
+                arg = (char *)memchr(arg, 0, argument_file->file_buf + argument_file->file_size - arg) + 1;
+            };
+        } else {
+            args_buffer[args_length++] = words[i];
+        };
+    };
+    args_buffer[args_length++] = NULL;
+    return args_buffer;
+};
+
+void spec_error(char * message, char * word) {
+    fprintf(stderr, "engine: %s:%zu: %s %s\n", spec_path, line_number, message, word);
+};
+
+// read the whole spec into a null-terminated buffer
+char * read_spec(void) {
+    int fd = open(spec_path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        perror("engine: open spec");
+        return NULL;
+    };
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        perror("engine: fstat");
+        return NULL;
+    };
+    char * spec = malloc(st.st_size + 1);
+    if (spec == NULL) {
+        perror("engine: malloc");
+        return NULL;
+    };
+    size_t size = 0;
+    while (size < (size_t)st.st_size) {
+        ssize_t n = read(fd, spec + size, st.st_size - size);
+        if (n < 0) {
+            perror("engine: read spec");
+            return NULL;
+        } else if (n == 0) {
+            break;
+        };
+        size += n;
+    };
+    close(fd);
+    spec[size] = 0;
+    return spec;
+};
+
+// split a line into words in place; returns the number of words
+size_t split_words(char * line, char * * words) {
+    size_t word_count = 0;
+    for (char * p = line; *p;) {
+        while (*p == ' ' || *p == '\t') {
+            *p++ = 0;
+        };
+        if (*p == 0) {
+            break;
+        };
+        words[word_count++] = p;
+        while (*p && *p != ' ' && *p != '\t') {
+            p++;
+        };
+    };
+    return word_count;
+};
+
+int main(int argc, char * argv []) {
+    if (argc > 2) {
+        fprintf(stderr, "%s\n", "usage: engine [SPEC]");
+        return 1;
+    } else if (argc == 2) {
+        spec_path = argv[1];
+    };
+    char * spec = read_spec();
+    if (spec == NULL) {
+        return 1;
+    };
+    // only the engine itself writes to the phase pipe, so none of the commands should inherit it
+    fcntl(PHASE_FD, F_SETFD, FD_CLOEXEC);
+    bool compiled = false;
+    // a line can't have more words than half its length, rounded up
+    char * * words = malloc((strlen(spec) / 2 + 2) * sizeof *words);
+    if (words == NULL) {
+        perror("engine: malloc");
+        return 1;
+    };
+    for (char * line = spec, * next; line != NULL; line = next) {
+        line_number++;
+        next = strchr(line, '\n');
+        if (next != NULL) {
+            *next++ = 0;
+        };
+        size_t word_count = split_words(line, words);
+        if (word_count == 0 || words[0][0] == '#') {
+            continue;
+        };
+        char * step = words[0];
+        if (strcmp(step, "cd") == 0) {
+            if (word_count != 2) {
+                spec_error("wrong number of arguments to", step);
+                return 1;
+            };
+            if (chdir(words[1]) < 0) {
+                perror("engine: chdir");
+                return 1;
+            };
+        } else if (strcmp(step, "mkdir") == 0) {
+            for (size_t i = 1; i < word_count; i++) {
+                if (mkdir(words[i], 0777) < 0 && errno != EEXIST) {
+                    perror("engine: mkdir");
+                    return 1;
+                };
+            };
+        } else if (strcmp(step, "symlink") == 0) {
+            if (word_count != 3) {
+                spec_error("wrong number of arguments to", step);
+                return 1;
+            };
+            if (symlink(words[1], words[2]) < 0 && errno != EEXIST) {
+                perror("engine: symlink");
+                return 1;
+            };
+        } else if (strcmp(step, "env") == 0) {
+            for (size_t i = 1; i < word_count; i++) {
+                char * separator = strchr(words[i], '=');
+                if (separator == NULL) {
+                    spec_error("invalid variable", words[i]);
+                    return 1;
+                };
+                *separator = 0;
+                if (setenv(words[i], separator + 1, 1) < 0) {
+                    perror("engine: setenv");
+                    return 1;
+                };
+            };
+        } else if (strcmp(step, "compile") == 0 || strcmp(step, "run") == 0) {
+            bool run = strcmp(step, "run") == 0;
+            size_t first = 1;
+            bool to_stderr = word_count > 1 && strcmp(words[1], ">&2") == 0;
+            if (to_stderr) {
+                first++;
+            };
+            if (first >= word_count) {
+                spec_error("no program given to", step);
+                return 1;
+            };
+            char * * args = build_argv(words + first, word_count - first);
+            if (args == NULL) {
+                return 1;
+            };
+            pid_t pid = run ? 0 : fork();
+            if (pid < 0) {
+                perror("engine: fork");
+                return 1;
+            } else if (pid == 0) {
+                if (run) {
+                    if (compiled && write(PHASE_FD, "run\n", 4) < 0) {
+                        perror("engine: mark phase");
+                    };
+                    int input_fd = open(INPUT_PATH, O_RDONLY);
+                    if (input_fd < 0 || dup2(input_fd, STDIN_FILENO) < 0) {
+                        perror("engine: opening input");
+                        return 1;
+                    };
+                    close(input_fd);
+                };
+                if (to_stderr && dup2(STDERR_FILENO, STDOUT_FILENO) < 0) {
+                    perror("engine: dup2");
+                    return 1;
+                };
+                execvp(args[0], args);
+                // shouldn't reach this point if execvp succeeds
+                perror("engine: execvp");
+                // the status a shell would give for a command that doesn't exist
+                _exit(127);
+            };
+            int status;
+            if (waitpid(pid, &status, 0) < 0) {
+                perror("engine: waitpid");
+                return 1;
+            };
+            if (WIFSIGNALED(status)) {
+                return 128 + WTERMSIG(status);
+            } else if (WEXITSTATUS(status) != 0) {
+                return WEXITSTATUS(status);
+            };
+            free(args);
+            compiled = true;
+        } else {
+            spec_error("unknown step", step);
+            return 1;
+        };
+    };
+    fprintf(stderr, "engine: %s: no run step\n", spec_path);
+    return 1;
+};
@@ -1,12 +1,22 @@
 package main
 
 import (
+	"flag"
 	"fmt"
 
 	"github.com/attempt-this-online/attempt-this-online/ato"
 )
 
+var listLanguages = flag.Bool("languages", false, "list each language with its image, instead of just the images")
+
 func main() {
+	flag.Parse()
+	if *listLanguages {
+		for name, language := range ato.Languages {
+			fmt.Println(name, language.Image)
+		}
+		return
+	}
 	images := make(map[string]struct{})
 	for _, language := range ato.Languages {
 		images[language.Image] = struct{}{}
@@ -0,0 +1,605 @@
+/* sandbox -- set up the environment for a single invocation and run it inside bwrap
+
+   This replaces the original zsh `sandbox` script, which spawned around a dozen processes (`ls`, `grep`, `sha256sum`,
+   `tr`, `mkdir`, a subshell, `env` and `yargs`) before bwrap even started. Everything it did is done here directly.
+
+   We *should* be able to trust that this program is only run from by the trusted API process, but if an attacker
+   somehow got RCE as the API user, they might be able to LPE using this + bwrap, so make sure everything is written
+   securely!
+
+   Usage: ATO_sandbox [-b <run budget ms>] [-c <CPU time ms>] [-i <instructions>] [-n <runs>] [-p] [-s]
+                      [-t <timeline interval ms>] [-u] [-w <warm-up runs>] [-x] <invocation ID> <language>
+                      <timeout ms> <image>
+
+   The options are passed on to the wrapper, after validation. -p profiles the program, into the file `profile` next to
+   `status`. If the language has a spec, it is run by the engine rather than by its runner script, unless -s is given.
+   If the language has a cache, it is mounted at /ATO/cache, with a writable layer on top which is thrown away
+   afterwards, unless -u is given. This needs bubblewrap 0.9 and Linux 5.11, so `setup/warm_caches` doesn't build any
+   caches if they aren't available.
+   -x traces the layers of the sandbox, for benchmarking: the wrapper is told when this program started and when it
+   exec'd bwrap, and includes them in the status along with the times of every fork, exec and exit in the sandbox.  */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define RUNNERS_DIR "/usr/local/share/ATO/runners"
+#define SPECS_DIR "/usr/local/share/ATO/specs"
+#define CACHE_DIR "/usr/local/lib/ATO/cache"
+#define ROOTFS_DIR "/usr/local/lib/ATO/rootfs"
+#define EXEC_SPEC_DIR "/usr/local/lib/ATO/exec_specs"
+#define INVOCATIONS_DIR "/run/ATO"
+// TODO: dynamically work out the cgroup path, rather than relying on hard-coded cgroup fs mount point and systemd
+// cgroup layout
+#define CGROUP_DIR "/sys/fs/cgroup/system.slice/ATO.service"
+#define BWRAP "/usr/bin/bwrap"
+
+#define MIN_INVOCATION_ID_LENGTH 17
+#define MAX_TIMEOUT_MS 60000
+#define MAX_RUNS 1000
+#define MAX_TIMELINE_INTERVAL_MS 1000
+// number of options which can be passed on to the wrapper
+#define WRAPPER_OPTIONS 6
+
+// maximum number of arguments passed to bwrap, not counting those from the image's exec-spec
+#define MAX_BWRAP_ARGS (85 + 2 * WRAPPER_OPTIONS)
+#define EXEC_SPEC_MAGIC "ATOx"
+#define EXEC_SPEC_VERSION 1
+
+// the environment of bwrap itself, on the host
+static char* const host_env[] = { "PATH=/usr/bin", NULL };
+
+#define CHECK(expr, name) do { \
+    if ((expr) < 0) { \
+        perror("sandbox: " name); \
+        return 1; \
+    } \
+} while (0)
+
+/* Minimal SHA-256 (FIPS 180-4), only used to make the invocation ID path-safe.  */
+
+static const uint32_t sha256_k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+#define ROTR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+static void
+sha256_block(uint32_t state[8], const unsigned char block[64])
+{
+    uint32_t w[64];
+    for (int i = 0; i < 16; i++)
+        w[i] = (uint32_t)block[i * 4] << 24 | (uint32_t)block[i * 4 + 1] << 16
+            | (uint32_t)block[i * 4 + 2] << 8 | (uint32_t)block[i * 4 + 3];
+    for (int i = 16; i < 64; i++) {
+        uint32_t s0 = ROTR(w[i - 15], 7) ^ ROTR(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        uint32_t s1 = ROTR(w[i - 2], 17) ^ ROTR(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+    uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+    uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+    for (int i = 0; i < 64; i++) {
+        uint32_t t1 = h + (ROTR(e, 6) ^ ROTR(e, 11) ^ ROTR(e, 25)) + ((e & f) ^ (~e & g)) + sha256_k[i] + w[i];
+        uint32_t t2 = (ROTR(a, 2) ^ ROTR(a, 13) ^ ROTR(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+        h = g; g = f; f = e; e = d + t1;
+        d = c; c = b; b = a; a = t1 + t2;
+    }
+    state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+    state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+}
+
+/* Write the lowercase hex SHA-256 digest of DATA into HEX, which must have space for 65 bytes.  */
+static void
+sha256_hex(const char* data, size_t length, char* hex)
+{
+    uint32_t state[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+    };
+    unsigned char block[64];
+    size_t i = 0;
+    for (; i + 64 <= length; i += 64)
+        sha256_block(state, (const unsigned char*)data + i);
+    size_t rest = length - i;
+    memcpy(block, data + i, rest);
+    block[rest++] = 0x80;
+    if (rest > 56) {
+        memset(block + rest, 0, 64 - rest);
+        sha256_block(state, block);
+        rest = 0;
+    }
+    memset(block + rest, 0, 56 - rest);
+    uint64_t bits = (uint64_t)length * 8;
+    for (int j = 0; j < 8; j++)
+        block[63 - j] = bits >> (j * 8);
+    sha256_block(state, block);
+    for (int j = 0; j < 32; j++)
+        sprintf(hex + j * 2, "%02x", (state[j / 4] >> (24 - (j % 4) * 8)) & 0xff);
+}
+
+/* Check that NAME is a plain (non-hidden) entry of DIR. This is what the original `ls DIR | grep -Fqx NAME` did,
+   and also prevents directory traversal.  */
+static bool
+is_entry(const char* dir, const char* name)
+{
+    struct stat st;
+    if (name[0] == '\0' || name[0] == '.' || strchr(name, '/') != NULL || strlen(name) > NAME_MAX)
+        return false;
+    int dir_fd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dir_fd < 0)
+        return false;
+    int result = fstatat(dir_fd, name, &st, AT_SYMLINK_NOFOLLOW);
+    close(dir_fd);
+    return result == 0;
+}
+
+long long parse_long(char* string) {
+    long long value = 0;
+    if (string[0] < '1') {
+        // invalid integer (must be >= 0)
+        exit(2);
+    }
+    for (int i = 0; string[i]; i++) {
+        if (string[i] < '0' || string[i] > '9' || i >= 18) {
+            // invalid integer
+            exit(2);
+        }
+        value *= 10;
+        value += string[i] - '0';
+    }
+    return value;
+}
+
+int parse_int(char* string) {
+    long long value = parse_long(string);
+    if (value > INT_MAX) {
+        exit(2);
+    }
+    return value;
+}
+
+/* Read the whole of the file PATH into a new buffer; its length is stored in SIZE.  */
+static char*
+read_file(const char* path, size_t* size)
+{
+    struct stat st;
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return NULL;
+    if (fstat(fd, &st) < 0) {
+        close(fd);
+        return NULL;
+    }
+    char* buf = malloc(st.st_size + 1);
+    if (buf == NULL) {
+        close(fd);
+        return NULL;
+    }
+    size_t total = 0;
+    while (total < (size_t)st.st_size) {
+        ssize_t n = read(fd, buf + total, st.st_size - total);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            free(buf);
+            close(fd);
+            return NULL;
+        } else if (n == 0)
+            break;
+        total += n;
+    }
+    close(fd);
+    *size = total;
+    return buf;
+}
+
+/* The exec-spec of an image is compiled by `setup/compile_exec_spec` when the image is installed. It holds the
+   arguments which bwrap needs for that image, the environment for the runner, and the working directory inside it. The
+   file is this header followed by ARGC + ENVC + 1 null-terminated strings, in that order, so that it only has to be
+   read and checked, and the strings are used in place. The environment is only used by the wrapper, which reads it
+   from the same file, mounted at /ATO/exec_spec.  */
+struct exec_spec_header {
+    char magic[4];
+    uint32_t version;
+    uint32_t argc;
+    uint32_t envc;
+    uint32_t strings_size;
+};
+
+struct exec_spec {
+    char** argv;
+    size_t argc;
+    char* cwd;
+};
+
+/* Load the exec-spec at PATH into SPEC. On failure, return -1 and set errno.  */
+static int
+load_exec_spec(const char* path, struct exec_spec* spec)
+{
+    size_t size;
+    char* buf = read_file(path, &size);
+    if (buf == NULL)
+        return -1;
+    struct exec_spec_header header;
+    if (size < sizeof header)
+        goto invalid;
+    memcpy(&header, buf, sizeof header);
+    if (memcmp(header.magic, EXEC_SPEC_MAGIC, sizeof header.magic) != 0 || header.version != EXEC_SPEC_VERSION
+        || header.strings_size != size - sizeof header || header.strings_size == 0 || buf[size - 1] != '\0')
+        goto invalid;
+    char* strings = buf + sizeof header;
+    size_t count = (size_t)header.argc + header.envc + 1, found = 0;
+    for (size_t i = 0; i < header.strings_size; i++)
+        if (strings[i] == '\0')
+            found++;
+    if (found != count)
+        goto invalid;
+    char** pointers = malloc((count + 1) * sizeof *pointers);
+    if (pointers == NULL) {
+        free(buf);
+        return -1;
+    }
+    for (size_t i = 0; i < count; i++) {
+        pointers[i] = strings;
+        strings += strlen(strings) + 1;
+    }
+    spec->argv = pointers;
+    spec->argc = header.argc;
+    spec->cwd = pointers[count - 1];
+    return 0;
+
+invalid:
+    free(buf);
+    errno = EINVAL;
+    return -1;
+}
+
+/* Whether the runner at PATH marks phases, so that the wrapper should give it the phase pipe: a spec (if SPEC) with a
+   compile step, after which the engine marks the run phase, or a runner script which writes to file descriptor 3. Other
+   runners don't get the pipe, so that the program can't write to it.  */
+static bool
+marks_phases(const char* path, bool spec)
+{
+    size_t size;
+    char* buf = read_file(path, &size);
+    if (buf == NULL)
+        return false;
+    buf[size] = '\0';
+    bool found = false;
+    if (spec) {
+        // the engine separates words with spaces or tabs
+        for (char* line = buf; line != NULL && !found; line = strchr(line, '\n')) {
+            if (*line == '\n')
+                line++;
+            line += strspn(line, " \t");
+            found = strncmp(line, "compile", 7) == 0 && (line[7] == ' ' || line[7] == '\t');
+        }
+    } else
+        found = strstr(buf, ">&3") != NULL;
+    free(buf);
+    return found;
+}
+
+static int
+write_file(const char* dir, const char* name, const char* value)
+{
+    char path[PATH_MAX];
+    snprintf(path, sizeof path, "%s/%s", dir, name);
+    int fd = open(path, O_WRONLY | O_CLOEXEC);
+    if (fd < 0)
+        return -1;
+    ssize_t n = write(fd, value, strlen(value));
+    close(fd);
+    return n < 0 ? -1 : 0;
+}
+
+/* Define resource limits (see setrlimit(2)). The soft limits are slightly less than the hard limits so that processes
+   get a signal and have a chance to recover.  */
+static int
+set_limits(void)
+{
+    static const struct { int resource; rlim_t value; } limits[] = {
+        { RLIMIT_FSIZE, 1048576 * 512 }, // file size (512MiB)
+        { RLIMIT_NPROC, 100 },           // processes (actually threads)
+        { RLIMIT_SIGPENDING, 100 },      // pending signals
+        { RLIMIT_LOCKS, 100 },           // file locks
+        { RLIMIT_MSGQUEUE, 65536 },      // bytes in POSIX message queues
+        { RLIMIT_CPU, 61 },              // CPU-seconds
+    };
+    for (size_t i = 0; i < sizeof limits / sizeof *limits; i++) {
+        rlim_t margin = limits[i].resource == RLIMIT_FSIZE ? 2 * 512 : 2;
+        struct rlimit rlimit = { limits[i].value - margin, limits[i].value };
+        if (setrlimit(limits[i].resource, &rlimit) < 0)
+            return -1;
+    }
+    return 0;
+}
+
+int main(int argc, char** argv)
+{
+    // options which are passed on to the wrapper, after validation
+    static char option_names[WRAPPER_OPTIONS][3];
+    char* wrapper_options[2 * WRAPPER_OPTIONS];
+    size_t wrapper_option_count = 0;
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    long long start_ns = (long long)now.tv_sec * 1000000000LL + now.tv_nsec;
+    bool profile = false, script = false, trace = false, uncached = false;
+    int opt;
+    while ((opt = getopt(argc, argv, "+b:c:i:n:pst:uw:x")) != -1) {
+        switch (opt) {
+        case 'p':
+            profile = true;
+            continue;
+        case 's':
+            script = true;
+            continue;
+        case 'u':
+            uncached = true;
+            continue;
+        case 'x':
+            trace = true;
+            continue;
+        case 'b':
+        case 'c':
+            if (parse_int(optarg) > MAX_TIMEOUT_MS)
+                return 2;
+            break;
+        case 'i':
+            parse_long(optarg);
+            break;
+        case 'n':
+        case 'w':
+            if (parse_int(optarg) > MAX_RUNS)
+                return 2;
+            break;
+        case 't':
+            if (parse_int(optarg) > MAX_TIMELINE_INTERVAL_MS)
+                return 2;
+            break;
+        default:
+            return 2;
+        }
+        if (wrapper_option_count == 2 * WRAPPER_OPTIONS)
+            return 2;
+        char* name = option_names[wrapper_option_count / 2];
+        name[0] = '-';
+        name[1] = opt;
+        wrapper_options[wrapper_option_count++] = name;
+        wrapper_options[wrapper_option_count++] = optarg;
+    }
+    if (argc - optind != 4) {
+        fprintf(stderr, "%s\n", "usage: ATO_sandbox [-b <run budget ms>] [-c <CPU time ms>] [-i <instructions>] "
+            "[-n <runs>] [-p] [-s] [-t <timeline interval ms>] [-u] [-w <warm-up runs>] [-x] <invocation ID> "
+            "<language> <timeout ms> <image>");
+        return 2;
+    }
+    char* invocation_id = argv[optind];
+    char* language = argv[optind + 1];
+    int timeout = parse_int(argv[optind + 2]);
+    char* image = argv[optind + 3];
+
+    // replace slash with plus so that the image name can be used as an individual filename
+    for (char* c = image; *c; c++)
+        if (*c == '/')
+            *c = '+';
+
+    // check that the runner and image exist (also prevents directory traversal)
+    if (!is_entry(RUNNERS_DIR, language) || !is_entry(ROOTFS_DIR, image)) {
+        fprintf(stderr, "%s\n", "sandbox: no such language or image");
+        return 2;
+    }
+    // the runner script is always there, as a fallback for languages without a spec
+    bool use_spec = !script && is_entry(SPECS_DIR, language);
+    // caches are generated by `setup/warm_caches`, only for some languages
+    bool use_cache = !uncached && is_entry(CACHE_DIR, language);
+
+    // ensure minimum lengths
+    if (strlen(invocation_id) < MIN_INVOCATION_ID_LENGTH || timeout < 1 || timeout > MAX_TIMEOUT_MS)
+        return 2;
+
+    // make sure ID is path-safe by getting a hashed version in hex
+    char hashed_id[65];
+    sha256_hex(invocation_id, strlen(invocation_id), hashed_id);
+
+    char invocation_dir[sizeof INVOCATIONS_DIR + sizeof hashed_id], path[PATH_MAX];
+    char cg[sizeof CGROUP_DIR + sizeof hashed_id];
+    snprintf(invocation_dir, sizeof invocation_dir, "%s/%s", INVOCATIONS_DIR, hashed_id);
+
+    // Open a file descriptor where the wrapper will write all the status information, and one for sandbox details,
+    // which will be written by bwrap immediately, to allow the process to be killed manually. These are deliberately
+    // inherited by bwrap.
+    snprintf(path, sizeof path, "%s/status", invocation_dir);
+    int status_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    CHECK(status_fd, "open status");
+    snprintf(path, sizeof path, "%s/info", invocation_dir);
+    int info_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    CHECK(info_fd, "open info");
+    // and one for the profile, if requested
+    int profile_fd = -1;
+    if (profile) {
+        snprintf(path, sizeof path, "%s/profile", invocation_dir);
+        profile_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+        CHECK(profile_fd, "open profile");
+    }
+
+    // The image's root file system and working directory come from its exec-spec. The spec is also mounted in the
+    // sandbox, for the wrapper to give the image's environment to the runner when it execs it, rather than each variable
+    // being a separate --setenv argument to bwrap.
+    char exec_spec_path[PATH_MAX];
+    snprintf(exec_spec_path, sizeof exec_spec_path, "%s/%s", EXEC_SPEC_DIR, image);
+    struct exec_spec exec_spec;
+    if (load_exec_spec(exec_spec_path, &exec_spec) < 0) {
+        perror("sandbox: load exec-spec");
+        return 1;
+    }
+
+    char** args = calloc(MAX_BWRAP_ARGS + exec_spec.argc, sizeof *args);
+    if (args == NULL) {
+        perror("sandbox: malloc");
+        return 1;
+    }
+    size_t n = 0;
+#define ARG(a) (args[n++] = (a))
+    ARG("bwrap");
+    for (size_t i = 0; i < exec_spec.argc; i++)
+        ARG(exec_spec.argv[i]);
+    // bwrap itself runs on the host, with host_env, none of which the sandbox needs
+    ARG("--clearenv");
+
+    char runner[PATH_MAX], spec[PATH_MAX], cache[PATH_MAX];
+    char input[PATH_MAX], code[PATH_MAX], arguments[PATH_MAX], options[PATH_MAX];
+    char info_fd_str[16], status_fd_str[16], profile_fd_str[16], timeout_str[16];
+    snprintf(runner, sizeof runner, "%s/%s", RUNNERS_DIR, language);
+    snprintf(spec, sizeof spec, "%s/%s", SPECS_DIR, language);
+    snprintf(cache, sizeof cache, "%s/%s", CACHE_DIR, language);
+    snprintf(input, sizeof input, "%s/input", invocation_dir);
+    snprintf(code, sizeof code, "%s/code", invocation_dir);
+    snprintf(arguments, sizeof arguments, "%s/arguments", invocation_dir);
+    snprintf(options, sizeof options, "%s/options", invocation_dir);
+    snprintf(info_fd_str, sizeof info_fd_str, "%d", info_fd);
+    snprintf(status_fd_str, sizeof status_fd_str, "%d", status_fd);
+    snprintf(profile_fd_str, sizeof profile_fd_str, "%d", profile_fd);
+    snprintf(timeout_str, sizeof timeout_str, "%d", timeout);
+    // use a cgroup to manage memory limits
+    snprintf(cg, sizeof cg, "%s/%s", CGROUP_DIR, hashed_id);
+    bool phases = marks_phases(use_spec ? spec : runner, use_spec);
+
+    ARG("--proc"); ARG("/proc");
+    ARG("--dev"); ARG("/dev");
+    ARG("--tmpfs"); ARG("/ATO");
+    ARG("--ro-bind"); ARG("/usr/local/bin/ATO_bash"); ARG("/ATO/bash");
+    ARG("--ro-bind"); ARG("/usr/local/bin/ATO_yargs"); ARG("/ATO/yargs");
+    ARG("--ro-bind"); ARG("/usr/local/bin/ATO_wrapper"); ARG("/ATO/wrapper");
+    if (use_spec) {
+        ARG("--ro-bind"); ARG("/usr/local/bin/ATO_engine"); ARG("/ATO/runner");
+        ARG("--ro-bind"); ARG(spec); ARG("/ATO/spec");
+    } else {
+        ARG("--ro-bind"); ARG(runner); ARG("/ATO/runner");
+    }
+    if (use_cache) {
+        // anything written to the cache only lasts for this invocation
+        ARG("--overlay-src"); ARG(cache); ARG("--tmp-overlay"); ARG("/ATO/cache");
+    }
+    ARG("--dir"); ARG("/ATO/context");
+    ARG("--chdir"); ARG(exec_spec.cwd);
+    ARG("--unshare-all");
+    ARG("--die-with-parent");
+    ARG("--hostname"); ARG("ATO_sandbox");
+    ARG("--info-fd"); ARG(info_fd_str);
+    ARG("--ro-bind"); ARG(input); ARG("/ATO/input");
+    ARG("--ro-bind"); ARG(code); ARG("/ATO/code");
+    ARG("--ro-bind"); ARG(arguments); ARG("/ATO/arguments");
+    ARG("--ro-bind"); ARG(options); ARG("/ATO/options");
+    ARG("--ro-bind"); ARG(exec_spec_path); ARG("/ATO/exec_spec");
+    // read-only, so that the wrapper can read the usage of the whole process tree, but nothing can change the limits
+    ARG("--ro-bind"); ARG(cg); ARG("/ATO/cgroup");
+
+    if (mkdir(cg, 0755) < 0 && errno != EEXIST) {
+        perror("sandbox: mkdir cgroup");
+        return 1;
+    }
+    int status = 1, memory_peak_fd = -1;
+    if (write_file(cg, "memory.high", "209715200") < 0    // create memory pressure if 200MiB used
+        || write_file(cg, "memory.max", "268435456") < 0  // absolute maximum memory 256MiB
+        || write_file(cg, "memory.swap.max", "0") < 0) {  // disallow swap
+        perror("sandbox: configure cgroup");
+        goto cleanup;
+    }
+
+    // The wrapper resets the peak memory usage at the start of each phase of the runner, which it can't do through the
+    // read-only mount. Only resetting this file descriptor's own view of the peak is possible with it. It's optional,
+    // because older kernels don't have memory.peak or don't allow writing to it.
+    char memory_peak_fd_str[16];
+    snprintf(path, sizeof path, "%s/memory.peak", cg);
+    memory_peak_fd = open(path, O_RDWR);
+    snprintf(memory_peak_fd_str, sizeof memory_peak_fd_str, "%d", memory_peak_fd);
+
+    ARG("/ATO/wrapper");
+    ARG("-e"); ARG("/ATO/exec_spec");
+    if (phases)
+        ARG("-f");
+    ARG("-g"); ARG("/ATO/cgroup");
+    if (memory_peak_fd >= 0) {
+        ARG("-m"); ARG(memory_peak_fd_str);
+    }
+    if (profile_fd >= 0) {
+        ARG("-p"); ARG(profile_fd_str);
+    }
+    for (size_t i = 0; i < wrapper_option_count; i++)
+        ARG(wrapper_options[i]);
+    // filled in just before bwrap is exec'd
+    char trace_str[48];
+    if (trace) {
+        ARG("-x"); ARG(trace_str);
+    }
+    ARG(status_fd_str); ARG(timeout_str);
+    ARG(NULL);
+#undef ARG
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("sandbox: fork");
+        goto cleanup;
+    } else if (pid == 0) {
+        // the limits and cgroup only apply to this child and its descendants
+        char pid_str[16];
+        snprintf(pid_str, sizeof pid_str, "%d", getpid());
+        if (set_limits() < 0) {
+            perror("sandbox: setrlimit");
+            _exit(1);
+        }
+        // join cgroup
+        if (write_file(cg, "cgroup.procs", pid_str) < 0) {
+            perror("sandbox: join cgroup");
+            _exit(1);
+        }
+        if (trace) {
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            snprintf(trace_str, sizeof trace_str, "%lld,%lld", start_ns,
+                (long long)now.tv_sec * 1000000000LL + now.tv_nsec);
+        }
+        // nothing from our environment either
+        execve(BWRAP, args, host_env);
+        perror("sandbox: execve");
+        _exit(1);
+    }
+
+    while (waitpid(pid, &status, 0) < 0) {
+        if (errno != EINTR) {
+            perror("sandbox: waitpid");
+            status = 1;
+            goto cleanup;
+        }
+    }
+    status = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+
+cleanup:
+    if (memory_peak_fd >= 0)
+        close(memory_peak_fd);
+    // ensure cgroup is cleaned up
+    if (rmdir(cg) < 0)
+        perror("sandbox: rmdir cgroup");
+    close(status_fd);
+    close(info_fd);
+    if (profile_fd >= 0)
+        close(profile_fd);
+    return status;
+}
@@ -19,57 +19,105 @@
 /* timeout - Start a command, and kill it if the specified timeout expires
 
    We try to behave like a shell starting a single (foreground) job,
-   and will kill the job if we receive the alarm signal we setup.
-   The exit status of the job is returned, or one of these errors:
-     EXIT_TIMEDOUT      124      job timed out
-     EXIT_CANCELED      125      internal error
-     EXIT_CANNOT_INVOKE 126      error executing job
-     EXIT_ENOENT        127      couldn't find job to exec
-
-   Caveats:
-     If user specifies the KILL (9) signal is to be sent on timeout,
-     the monitor is killed and so exits with 128+9 rather than 124.
-
-     If you start a command in the background, which reads from the tty
-     and so is immediately sent SIGTTIN to stop, then the timeout
-     process will ignore this so it can timeout the command as expected.
-     This can be seen with 'timeout 10 dd&' for example.
-     However if one brings this group to the foreground with the 'fg'
-     command before the timer expires, the command will remain
-     in the stop state as the shell doesn't send a SIGCONT
-     because the timeout process (group leader) is already running.
-     To get the command running again one can Ctrl-Z, and do fg again.
-     Note one can Ctrl-C the whole job when in this state.
-     I think this could be fixed but I'm not sure the extra
-     complication is justified for this scenario.
+   and will kill the job if the timer we setup expires.
+   The child is started with clone(CLONE_VM | CLONE_VFORK | CLONE_PIDFD), so
+   our page tables aren't copied just to be thrown away by the exec, and its
+   pidfd comes with it, with no window in which its pid could be reused.
+   The monitor waits on that pidfd, a CLOCK_MONOTONIC timerfd
+   for the deadline, and a signalfd for signals sent to us, all in a single
+   epoll loop, so no work is done in signal handlers and the child is reaped
+   without races. Further event sources can be added to the same loop.
+   The runner can be run several times in a row, to benchmark it without
+   paying for a new sandbox each time; the limits apply to all runs together.
+   The runner can also mark phases, like compiling and running, through a
+   pipe, and the usage of each phase is reported separately. Optionally, the
+   whole tree is profiled, and its call stacks are written to another file.
+   For benchmarking the sandbox itself, the time of every fork, exec and exit
+   in the tree can be traced, along with when the wrapper started.
 
    Written by Pádraig Brady.  */
 
-#include <assert.h>
+#define _GNU_SOURCE /* for pipe2, asprintf and clone */
+
+#include <elf.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <limits.h>
+#include <linux/perf_event.h>
+#include <math.h>
+#include <sched.h>
 #include <signal.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
 #include <sys/prctl.h>
 #include <sys/resource.h>
+#include <sys/signalfd.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/timerfd.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <time.h>
 #include <unistd.h>
 
-/* NonStop circa 2011 lacks both SA_RESTART and siginterrupt.  */
-#ifndef SA_RESTART
-#define SA_RESTART 0
-#endif
-
 #define PROGRAM_NAME "timeout"
 
 // #define AUTHORS proper_name("Padraig Brady")
 
-#define MAX_TIMEOUT_SECS 60
+#define MAX_TIMEOUT_MS 60000
+
+// shortest interval between two checks of the CPU time budget
+#define MIN_CPU_CHECK_NS 1000000LL
+
+// number of slices the instruction limit is divided into; each process using up another slice triggers a check
+#define INSTRUCTION_CHECKS 16
+// interval between checks of the instruction count of the whole tree, which catch many processes or threads each
+// using less than a slice
+#define INSTRUCTION_POLL_NS 10000000LL
+
+// size of each perf ring buffer in pages, not counting the header page; must be a power of two
+#define RING_PAGES 8
+// the same for the profiler, which gets many more records
+#define PROFILE_RING_PAGES 32
+
+// samples per second taken by the profiler, chosen not to be in step with timers in the program
+#define PROFILE_FREQUENCY 997
+// maximum size of the profile output
+#define PROFILE_MAX_BYTES (1 << 20)
+/* the stack the child uses between being cloned and exec'ing the runner */
+#define SPAWN_STACK_SIZE (64 * 1024)
+/* maximum number of forks, execs and exits which are traced */
+#define TRACE_EVENTS 1024
+
+// number of samples kept in the timeline
+#define TIMELINE_SAMPLES 512
+// limits of the interval between samples in the timeline
+#define MIN_TIMELINE_INTERVAL_MS 1
+#define MAX_TIMELINE_INTERVAL_MS 1000
+
+// maximum number of measured runs, not counting warm-up runs
+#define MAX_RUNS 1000
+
+// the file descriptor on which the runner marks the start of each phase
+#define PHASE_FD 3
+// maximum number of different phases, and length of their names
+#define MAX_PHASES 8
+#define MAX_PHASE_NAME 15
+// name of the phase in which the runner starts
+#define FIRST_PHASE "compile"
+
+// inode number of the initial PID namespace (PROC_PID_INIT_INO in the kernel)
+#define INITIAL_PID_NAMESPACE 0xEFFFFFFCULL
+
+// format of the image's exec-spec (see `struct exec_spec_header` in sandbox.c)
+#define EXEC_SPEC_MAGIC "ATOx"
+#define EXEC_SPEC_VERSION 1
 
 #define DPRINTF(d, f, ...) do { \
     int _result; \
@@ -84,158 +132,1508 @@
 #define TIMESPEC(ts) ((long long)ts.tv_sec * 1000000000LL + (long long)ts.tv_nsec)
 #define TIMEVAL(tv) ((long long)tv.tv_sec * 1000000000LL + (long long)tv.tv_usec * 1000LL)
 
+// prints a number, or null if it is negative (meaning it wasn't available)
+#define DPRINTF_OPTIONAL(d, name, value) do { \
+    if ((value) < 0) \
+        DPRINTF(d, "\"%s\":null,", name); \
+    else \
+        DPRINTF(d, "\"%s\":%lld,", name, (long long)(value)); \
+} while (0)
+
+// prefers the usage of the whole tree from the cgroup, if it was available
+#define TREE(cgroup_value, rusage_value) ((cgroup_value) >= 0 ? (cgroup_value) : (long long)(rusage_value))
+
+/* Sources of events in the monitor's epoll loop; stored in epoll_event.data.u32.  */
+enum event_source {
+    EVENT_CHILD,             /* the pidfd of the monitored child became readable: it has exited */
+    EVENT_TIMER,             /* the timeout expired */
+    EVENT_CPU_TIMER,         /* time to check the CPU time budget */
+    EVENT_INSTRUCTIONS,      /* another slice of the instruction limit was used */
+    EVENT_INSTRUCTION_TIMER, /* time to check the instruction count */
+    EVENT_PHASE,             /* the runner marked the start of a new phase */
+    EVENT_PROFILE,           /* the profiler's ring buffers are filling up */
+    EVENT_TRACE,             /* the tracer's ring buffers are filling up */
+    EVENT_TIMELINE,          /* time to add a sample to the timeline */
+    EVENT_SIGNAL,            /* we were sent a signal */
+};
+
 static int timed_out;
+static const char* limit; /* which limit caused the timeout, if any.  */
+static const char* limit_unavailable; /* which requested limit can't be enforced on this server, if any.  */
 static int term_signal = SIGKILL; /* same default as kill command.  */
-static int timeout_secs = MAX_TIMEOUT_SECS;
+static int timeout_ms = MAX_TIMEOUT_MS;
+static int cpu_time_ms; /* CPU time budget for the whole process tree, or 0 for none.  */
+static long long instruction_limit; /* instruction budget for the whole process tree, or 0 for none.  */
+static int cgroup_fd = -1; /* the invocation's cgroup directory, if given.  */
 static pid_t monitored_pid;
+static int monitored_pidfd = -1;
 static bool foreground; /* whether to use another program group.  */
-static bool preserve_status; /* whether to use a timeout status or not.  */
+static bool own_pid_namespace; /* whether we are in a PID namespace of our own, as in the sandbox.  */
+static bool interrupted; /* whether we were sent a signal, so no more runs should be started.  */
+static int runs = 1; /* number of measured runs of the runner.  */
+static int warmup_runs; /* number of extra runs before the measured ones, whose usage is thrown away.  */
+static int run_budget_ms; /* don't start another run after this much time, or 0 for no such budget.  */
+
+static int
+pidfd_send_signal(int pidfd, int sig)
+{
+    return syscall(SYS_pidfd_send_signal, pidfd, sig, NULL, 0);
+}
+
+/* Arm TIMER_FD to expire NS nanoseconds after START, on the monotonic clock.  */
+static int
+settimeout(int timer_fd, struct timespec start, long long ns)
+{
+    long long deadline = TIMESPEC(start) + ns;
+    struct itimerspec its = { { 0, 0 }, { deadline / 1000000000LL, deadline % 1000000000LL } };
+    return timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &its, NULL);
+}
 
-/* Start the timeout after which we'll receive a SIGALRM. */
+/* Send SIG to the monitored child. The pidfd refers to exactly that process,
+   so the signal can never reach an unrelated process that reused its PID.  */
 static void
-settimeout(bool warn)
+send_sig(int sig)
 {
-    struct timespec ts = { timeout_secs, 0 };
-    struct itimerspec its = { { 0, 0 }, ts };
-    timer_t timerid;
-    if (timer_create(CLOCK_REALTIME, NULL, &timerid) == 0) {
-        if (timer_settime(timerid, 0, &its, NULL) == 0)
-            return;
-        else {
-            if (warn)
-                perror("warning: timer_settime");
-            timer_delete(timerid);
+    if (pidfd_send_signal(monitored_pidfd, sig) < 0 && errno != ESRCH)
+        perror("warning: pidfd_send_signal");
+}
+
+/* Send SIG to the monitored child and every other process in our PID namespace,
+   so that a limit applies to the whole process tree and not just the child,
+   including processes which left our process group with setsid or setpgid.
+   kill(-1) reaches every process in the namespace except its init (bwrap) and
+   us, in one system call, so no PID can be reused in between. Our cgroup
+   can't be used for this, because we are in it too. Outside a namespace of
+   our own, -1 would reach every process of the user, so only the child is
+   signalled.  */
+static void
+kill_tree(int sig)
+{
+    send_sig(sig);
+    if (own_pid_namespace && kill(-1, sig) < 0 && errno != ESRCH)
+        perror("warning: kill");
+}
+
+/* Find the value of KEY in BUF, the contents of a flat-keyed cgroup file, or -1 if it isn't there.  */
+static long long
+parse_cgroup_key(const char* buf, const char* key)
+{
+    size_t key_length = strlen(key);
+    const char* line = buf;
+    while (line != NULL) {
+        if (strncmp(line, key, key_length) == 0 && line[key_length] == ' ')
+            return strtoll(line + key_length + 1, NULL, 10);
+        line = strchr(line, '\n');
+        if (line != NULL)
+            line++;
+    }
+    return -1;
+}
+
+/* Read the value of KEY from the flat-keyed cgroup file open at FD, or -1 if it can't be read.  */
+static long long
+read_cgroup_key(int fd, const char* key)
+{
+    char buf[4096];
+    ssize_t n = pread(fd, buf, sizeof buf - 1, 0);
+    if (n < 0)
+        return -1;
+    buf[n] = '\0';
+    return parse_cgroup_key(buf, key);
+}
+
+/* Read the cgroup file NAME into BUF as a string, returning false if it can't be read.  */
+static bool
+read_cgroup_file(const char* name, char* buf, size_t size)
+{
+    int fd = openat(cgroup_fd, name, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return false;
+    ssize_t n = read(fd, buf, size - 1);
+    close(fd);
+    if (n < 0)
+        return false;
+    buf[n] = '\0';
+    return true;
+}
+
+/* Sum the values of KEY over all devices in BUF, the contents of io.stat.  */
+static long long
+sum_io_key(const char* buf, const char* key)
+{
+    long long total = 0;
+    size_t key_length = strlen(key);
+    for (const char* p = strstr(buf, key); p != NULL; p = strstr(p + key_length, key))
+        if (p[-1] == ' ' && p[key_length] == '=')
+            total += strtoll(p + key_length + 1, NULL, 10);
+    return total;
+}
+
+/* Resource usage of the whole process tree, read from the invocation's cgroup. Unlike RUSAGE_CHILDREN, this includes
+   every process ever in the tree, whether or not it was waited for. Any value that couldn't be read is -1.  */
+struct cgroup_usage {
+    long long user, kernel; /* nanoseconds */
+    long long max_mem; /* kilobytes */
+    long long major_page_faults, minor_page_faults;
+    long long read_bytes, write_bytes, input_ops, output_ops;
+    long long oom_kills, memory_high_events, memory_max_events;
+};
+
+static void
+read_cgroup_usage(struct cgroup_usage* usage)
+{
+    char buf[4096];
+    memset(usage, -1, sizeof *usage);
+    if (cgroup_fd < 0)
+        return;
+    if (read_cgroup_file("cpu.stat", buf, sizeof buf)) {
+        long long user = parse_cgroup_key(buf, "user_usec"), kernel = parse_cgroup_key(buf, "system_usec");
+        usage->user = user < 0 ? -1 : user * 1000;
+        usage->kernel = kernel < 0 ? -1 : kernel * 1000;
+    }
+    if (read_cgroup_file("memory.peak", buf, sizeof buf))
+        usage->max_mem = strtoll(buf, NULL, 10) / 1024;
+    if (read_cgroup_file("memory.stat", buf, sizeof buf)) {
+        long long all = parse_cgroup_key(buf, "pgfault"), major = parse_cgroup_key(buf, "pgmajfault");
+        if (all >= 0 && major >= 0) {
+            usage->major_page_faults = major;
+            usage->minor_page_faults = all - major;
         }
-    } else if (warn && errno != ENOSYS)
-        perror("warning: timer_create");
+    }
+    if (read_cgroup_file("memory.events", buf, sizeof buf)) {
+        usage->oom_kills = parse_cgroup_key(buf, "oom_kill");
+        usage->memory_high_events = parse_cgroup_key(buf, "high");
+        usage->memory_max_events = parse_cgroup_key(buf, "max");
+    }
+    if (read_cgroup_file("io.stat", buf, sizeof buf)) {
+        usage->read_bytes = sum_io_key(buf, "rbytes");
+        usage->write_bytes = sum_io_key(buf, "wbytes");
+        usage->input_ops = sum_io_key(buf, "rios");
+        usage->output_ops = sum_io_key(buf, "wios");
+    }
+}
+
+/* Subtract the usage in BASELINE, from before the child was started, from the cumulative counters in USAGE.  */
+static void
+subtract_cgroup_usage(struct cgroup_usage* usage, const struct cgroup_usage* baseline)
+{
+#define SUBTRACT(field) if (usage->field >= 0 && baseline->field >= 0) usage->field -= baseline->field
+    SUBTRACT(user);
+    SUBTRACT(kernel);
+    SUBTRACT(major_page_faults);
+    SUBTRACT(minor_page_faults);
+    SUBTRACT(read_bytes);
+    SUBTRACT(write_bytes);
+    SUBTRACT(input_ops);
+    SUBTRACT(output_ops);
+    SUBTRACT(oom_kills);
+    SUBTRACT(memory_high_events);
+    SUBTRACT(memory_max_events);
+#undef SUBTRACT
+}
+
+/* CPU time in nanoseconds used so far by everything in the invocation's cgroup.  */
+static long long
+cgroup_cpu_time(int cpu_stat_fd)
+{
+    long long usec = read_cgroup_key(cpu_stat_fd, "usage_usec");
+    return usec < 0 ? -1 : usec * 1000;
+}
+
+/* Check the CPU time budget: kill the child if it has run out, otherwise arm CPU_TIMER_FD for the earliest time it
+   could run out, given that at most every CPU is busy until then. BASELINE is the CPU time already used when the
+   child was started.  */
+static void
+check_cpu_time(int cpu_timer_fd, int cpu_stat_fd, long long baseline)
+{
+    static long cpus;
+    if (cpus == 0) {
+        cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        if (cpus < 1)
+            cpus = 1;
+    }
+    long long used = cgroup_cpu_time(cpu_stat_fd);
+    if (used < 0) {
+        perror("warning: reading cpu.stat");
+        return;
+    }
+    long long remaining = cpu_time_ms * 1000000LL - (used - baseline);
+    if (remaining <= 0) {
+        if (!timed_out) {
+            timed_out = 1;
+            limit = "cpu_time";
+            kill_tree(term_signal);
+        }
+        return;
+    }
+    long long wait = remaining / cpus;
+    if (wait < MIN_CPU_CHECK_NS)
+        wait = MIN_CPU_CHECK_NS;
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if (settimeout(cpu_timer_fd, now, wait) < 0)
+        perror("warning: timerfd_settime");
+}
+
+/* The timeline: samples of the usage of the whole process tree, taken at regular intervals while it runs. It has a
+   fixed size, and when it fills up, every other sample is dropped and the interval is doubled, so that it always covers
+   the whole run.  */
+struct timeline_sample {
+    long long time; /* nanoseconds since the start */
+    long long memory; /* kilobytes in use */
+    long long cpu; /* nanoseconds of CPU time used since the start */
+    long long processes; /* number of processes */
+};
+
+static struct timeline_sample timeline[TIMELINE_SAMPLES];
+static int timeline_length;
+static long long timeline_interval_ns; /* 0 if there is no timeline.  */
+static long long timeline_cpu_baseline; /* CPU time already used at the start.  */
+static int memory_current_fd = -1, timeline_cpu_stat_fd = -1, cgroup_procs_fd = -1;
+
+/* Arm TIMER_FD to expire every NS nanoseconds from now.  */
+static int
+setinterval(int timer_fd, long long ns)
+{
+    struct itimerspec its = { { ns / 1000000000LL, ns % 1000000000LL }, { ns / 1000000000LL, ns % 1000000000LL } };
+    return timerfd_settime(timer_fd, 0, &its, NULL);
+}
+
+/* Open the cgroup files read for the timeline. Memory usage is left out if the memory controller isn't enabled.  */
+static int
+open_timeline(void)
+{
+    memory_current_fd = openat(cgroup_fd, "memory.current", O_RDONLY | O_CLOEXEC);
+    timeline_cpu_stat_fd = openat(cgroup_fd, "cpu.stat", O_RDONLY | O_CLOEXEC);
+    cgroup_procs_fd = openat(cgroup_fd, "cgroup.procs", O_RDONLY | O_CLOEXEC);
+    return timeline_cpu_stat_fd < 0 || cgroup_procs_fd < 0 ? -1 : 0;
+}
+
+/* Count the processes in the invocation's cgroup, or return -1 if it can't be read.  */
+static long long
+count_processes(void)
+{
+    char buf[4096];
+    long long count = 0;
+    off_t offset = 0;
+    ssize_t n;
+    while ((n = pread(cgroup_procs_fd, buf, sizeof buf, offset)) > 0) {
+        for (ssize_t i = 0; i < n; i++)
+            count += buf[i] == '\n';
+        offset += n;
+    }
+    return n < 0 ? -1 : count;
+}
+
+/* Add a sample to the timeline, taken ELAPSED nanoseconds after the start. TIMER_FD is rearmed if the interval has to
+   change.  */
+static void
+sample_timeline(int timer_fd, long long elapsed)
+{
+    if (timeline_length == TIMELINE_SAMPLES) {
+        /* keep the later of each pair, but not at the expense of losing peaks */
+        for (int i = 0; i < TIMELINE_SAMPLES / 2; i++) {
+            struct timeline_sample* first = &timeline[2 * i];
+            struct timeline_sample second = timeline[2 * i + 1];
+            if (first->memory > second.memory)
+                second.memory = first->memory;
+            if (first->processes > second.processes)
+                second.processes = first->processes;
+            timeline[i] = second;
+        }
+        timeline_length = TIMELINE_SAMPLES / 2;
+        timeline_interval_ns *= 2;
+        if (timer_fd >= 0 && setinterval(timer_fd, timeline_interval_ns) < 0)
+            perror("warning: timerfd_settime");
+    }
+    char buf[32];
+    ssize_t n = memory_current_fd < 0 ? -1 : pread(memory_current_fd, buf, sizeof buf - 1, 0);
+    long long cpu = read_cgroup_key(timeline_cpu_stat_fd, "usage_usec");
+    if (n > 0)
+        buf[n] = '\0';
+    if (timeline_length == 0)
+        timeline_cpu_baseline = cpu;
+    timeline[timeline_length++] = (struct timeline_sample){
+        .time = elapsed,
+        .memory = n > 0 ? strtoll(buf, NULL, 10) / 1024 : -1,
+        .cpu = cpu < 0 || timeline_cpu_baseline < 0 ? -1 : (cpu - timeline_cpu_baseline) * 1000,
+        .processes = count_processes(),
+    };
+}
+
+/* Print the timeline as a JSON array of [time, memory, CPU time, processes] arrays, where values which couldn't be
+   read are null.  */
+static int
+print_timeline(int fd)
+{
+    DPRINTF(fd, "%s", "[");
+    for (int i = 0; i < timeline_length; i++) {
+        long long values[] = { timeline[i].time, timeline[i].memory, timeline[i].cpu, timeline[i].processes };
+        for (size_t j = 0; j < sizeof values / sizeof *values; j++) {
+            const char* separator = j == 0 ? (i == 0 ? "[" : ",[") : ",";
+            if (values[j] < 0)
+                DPRINTF(fd, "%snull", separator);
+            else
+                DPRINTF(fd, "%s%lld", separator, values[j]);
+        }
+        DPRINTF(fd, "%s", "]");
+    }
+    DPRINTF(fd, "%s", "]");
+    return 0;
+}
+
+/* Performance counters for the whole process tree. They are opened on ourself before the child is started, inherited
+   by every process it creates, and only enabled once the child execs the runner, so the monitor isn't counted.  */
+struct counter {
+    const char* name;
+    uint32_t type;
+    uint64_t config;
+    /* whether the events only happen in the kernel, so that the counter is useless if it can only count user space */
+    bool kernel_only;
+    int fd;
+};
+
+#define HW_CACHE(cache, op, result) \
+    (PERF_COUNT_HW_CACHE_##cache | PERF_COUNT_HW_CACHE_OP_##op << 8 | PERF_COUNT_HW_CACHE_RESULT_##result << 16)
 
-    /* fallback to single second resolution provided by alarm().  */
-    alarm(timeout_secs);
+static struct counter counters[] = {
+    /* must be first; see INSTRUCTIONS */
+    { "instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS, false, -1 },
+    { "cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, false, -1 },
+    { "l1d_misses", PERF_TYPE_HW_CACHE, HW_CACHE(L1D, READ, MISS), false, -1 },
+    { "llc_misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES, false, -1 },
+    { "branch_misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES, false, -1 },
+    /* software counters don't need the PMU, so they work even in VMs which don't expose it */
+    { "task_clock", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK, false, -1 },
+    { "context_switches", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES, true, -1 },
+    { "page_faults", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS, false, -1 },
+};
+
+#define COUNTERS (sizeof counters / sizeof *counters)
+#define INSTRUCTIONS (counters[0])
+
+static int
+perf_event_open(struct perf_event_attr* attr, pid_t pid, int cpu, int group_fd, unsigned long flags)
+{
+    return syscall(SYS_perf_event_open, attr, pid, cpu, group_fd, flags);
+}
+
+/* Open an inherited COUNTER on ourself, which is enabled when a descendant execs.  */
+static int
+open_counter(const struct counter* counter)
+{
+    struct perf_event_attr attr = {
+        .size = sizeof attr,
+        .type = counter->type,
+        .config = counter->config,
+        .read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING,
+        .disabled = 1,
+        .inherit = 1,
+        .enable_on_exec = 1,
+        .exclude_hv = 1,
+    };
+    /* Software events like context switches happen in the kernel, so try to include it, but unprivileged users can
+       usually only count user space (unless perf_event_paranoid is 1 or less). Counting only user space would always
+       give 0 for events which only happen in the kernel, so those are left unavailable instead.  */
+    int fd = -1;
+    if (counter->type == PERF_TYPE_SOFTWARE)
+        fd = perf_event_open(&attr, 0, -1, -1, PERF_FLAG_FD_CLOEXEC);
+    if (fd < 0 && !counter->kernel_only) {
+        attr.exclude_kernel = 1;
+        fd = perf_event_open(&attr, 0, -1, -1, PERF_FLAG_FD_CLOEXEC);
+    }
+    return fd;
+}
+
+/* Open as many of the counters as the kernel and hardware support. Unsupported ones are left closed.  */
+static void
+open_counters(void)
+{
+    for (size_t i = 0; i < COUNTERS; i++)
+        counters[i].fd = open_counter(&counters[i]);
+}
+
+/* Read the total of the counter open at FD, over ourself and all descendants, or -1 if it's not available. If the
+   hardware had to multiplex it with other counters, the value is scaled up to an estimate for the whole time.  */
+static long long
+read_counter(int fd)
+{
+    uint64_t values[3]; /* value, time enabled, time running */
+    if (fd < 0 || read(fd, values, sizeof values) != sizeof values)
+        return -1;
+    if (values[2] == 0)
+        return values[1] == 0 ? 0 : -1;
+    if (values[2] < values[1])
+        return (long long)((double)values[0] * values[1] / values[2]);
+    return values[0];
 }
 
-/* send SIG avoiding the current process.  */
+/* A sampling perf event, with a ring buffer that the kernel writes records to. The kernel doesn't allow inherited
+   events which are per-task on every CPU to be mmaped, so there is a separate event and buffer for each CPU.  */
+struct sampler {
+    int cpus;
+    int pages; /* size of each ring buffer, not counting the header page */
+    int* fds;
+    struct perf_event_mmap_page** rings;
+};
 
+/* Open the event described by ATTR on ourself, on each CPU, with a ring buffer of PAGES pages. Returns -1 if it
+   couldn't be opened on any CPU.  */
 static int
-send_sig(pid_t where, int sig)
-{
-    /* If sending to the group, then ignore the signal,
-     so we don't go into a signal loop.  Note that this will ignore any of the
-     signals registered in install_cleanup(), that are sent after we
-     propagate the first one, which hopefully won't be an issue.  Note this
-     process can be implicitly multithreaded due to some timer_settime()
-     implementations, therefore a signal sent to the group, can be sent
-     multiple times to this process.  */
-    if (where == 0)
-        signal(sig, SIG_IGN);
-    return kill(where, sig);
-}
-
-/* Signal handler which is required for sigsuspend() to be interrupted
-   whenever SIGCHLD is received.  */
+open_sampler(struct sampler* sampler, struct perf_event_attr* attr, int pages)
+{
+    long page_size = sysconf(_SC_PAGESIZE);
+    sampler->cpus = sysconf(_SC_NPROCESSORS_CONF);
+    sampler->pages = pages;
+    sampler->fds = calloc(sampler->cpus, sizeof *sampler->fds);
+    sampler->rings = calloc(sampler->cpus, sizeof *sampler->rings);
+    if (sampler->fds == NULL || sampler->rings == NULL)
+        return -1;
+    int opened = 0;
+    for (int cpu = 0; cpu < sampler->cpus; cpu++) {
+        sampler->fds[cpu] = perf_event_open(attr, 0, cpu, -1, PERF_FLAG_FD_CLOEXEC);
+        if (sampler->fds[cpu] < 0)
+            continue; /* probably offline */
+        void* ring = mmap(NULL, (1 + pages) * page_size, PROT_READ | PROT_WRITE, MAP_SHARED, sampler->fds[cpu], 0);
+        if (ring == MAP_FAILED) {
+            close(sampler->fds[cpu]);
+            sampler->fds[cpu] = -1;
+            continue;
+        }
+        sampler->rings[cpu] = ring;
+        opened++;
+    }
+    return opened > 0 ? 0 : -1;
+}
+
+/* Pass each record waiting in SAMPLER's ring buffers to HANDLE (if it isn't NULL), and then free up the space they
+   used.  */
 static void
-chld(int sig)
+drain_sampler(struct sampler* sampler, void (*handle)(struct perf_event_header* record, void* context), void* context)
 {
+    static unsigned char copy[1 << 16]; /* for records which wrap around the end of the buffer */
+    long page_size = sysconf(_SC_PAGESIZE);
+    uint64_t size = sampler->pages * page_size;
+    for (int cpu = 0; cpu < sampler->cpus; cpu++) {
+        struct perf_event_mmap_page* ring = sampler->rings[cpu];
+        if (ring == NULL)
+            continue;
+        unsigned char* data = (unsigned char*)ring + page_size;
+        uint64_t head = __atomic_load_n(&ring->data_head, __ATOMIC_ACQUIRE);
+        uint64_t tail = ring->data_tail;
+        while (tail < head) {
+            /* records are 8-byte aligned, so the header itself never wraps */
+            struct perf_event_header* record = (struct perf_event_header*)(data + tail % size);
+            if (record->size == 0)
+                break;
+            if (handle != NULL) {
+                uint64_t offset = tail % size;
+                if (offset + record->size > size) {
+                    memcpy(copy, data + offset, size - offset);
+                    memcpy(copy + size - offset, data, record->size - (size - offset));
+                    record = (struct perf_event_header*)copy;
+                }
+                handle(record, context);
+            }
+            tail += record->size;
+        }
+        __atomic_store_n(&ring->data_tail, tail, __ATOMIC_RELEASE);
+    }
 }
 
+/* Open an event which wakes us up every time a process has used another slice of the instruction limit. The wakeups
+   only trigger a check of the exact total. Each inherited copy of the event counts its own slices, so a tree of many
+   processes or threads could use nearly a slice each without waking us up; the total is also checked every
+   INSTRUCTION_POLL_NS, so that the tree can't run past the limit by more than it can execute in that time.  */
+static int
+open_instruction_sampler(struct sampler* sampler)
+{
+    struct perf_event_attr attr = {
+        .size = sizeof attr,
+        .type = PERF_TYPE_HARDWARE,
+        .config = PERF_COUNT_HW_INSTRUCTIONS,
+        .sample_period = instruction_limit / INSTRUCTION_CHECKS > 0 ? instruction_limit / INSTRUCTION_CHECKS : 1,
+        .wakeup_events = 1,
+        .disabled = 1,
+        .inherit = 1,
+        .enable_on_exec = 1,
+        .exclude_kernel = 1,
+        .exclude_hv = 1,
+    };
+    return open_sampler(sampler, &attr, RING_PAGES);
+}
+
+/* Whether the whole process tree has used up the instruction limit.  */
+static bool
+instruction_limit_reached(void)
+{
+    return instruction_limit != 0 && read_counter(INSTRUCTIONS.fd) >= instruction_limit;
+}
+
+/* Kill the child if the whole process tree has used up the instruction limit.  */
 static void
-cleanup(int sig)
+check_instruction_limit(void)
 {
-    if (sig == SIGALRM) {
+    if (instruction_limit_reached() && !timed_out) {
         timed_out = 1;
-        sig = term_signal;
+        limit = "instructions";
+        kill_tree(term_signal);
     }
-    if (monitored_pid) {
-        /* Send the signal directly to the monitored child,
-         in case it has itself become group leader,
-         or is not running in a separate group.  */
-        send_sig(monitored_pid, sig);
-    } else /* we're the child or the child is not exec'd yet.  */
-        _exit(128 + sig);
 }
 
+/* Cumulative usage of the whole process tree, which is sampled at the boundaries of runs and phases.  */
+enum usage_field {
+    USAGE_REAL,
+    USAGE_USER,
+    USAGE_KERNEL,
+    USAGE_INSTRUCTIONS,
+    USAGE_MAJOR_PAGE_FAULTS,
+    USAGE_MINOR_PAGE_FAULTS,
+    USAGE_FIELDS
+};
+
+/* the fields which are summarised when the runner is run several times */
+#define RUN_FIELDS (USAGE_INSTRUCTIONS + 1)
+
+static const char* const usage_field_names[USAGE_FIELDS] = {
+    "real", "user", "kernel", "instructions", "major_page_faults", "minor_page_faults"
+};
+static long long run_usage[RUN_FIELDS][MAX_RUNS]; /* usage of each measured run; -1 if it isn't available */
+static int measured_runs;
+static long long spawn_latencies[MAX_RUNS]; /* time from cloning each measured run to its exec */
+static long long first_spawn_latency;
+
+/* Take a snapshot of the cumulative usage of the whole process tree into SAMPLE.  */
 static void
-unblock_signal(int sig)
+take_sample(long long sample[USAGE_FIELDS])
 {
-    sigset_t unblock_set;
-    sigemptyset(&unblock_set);
-    sigaddset(&unblock_set, sig);
-    if (sigprocmask(SIG_UNBLOCK, &unblock_set, NULL) != 0)
-        perror("warning: sigprocmask");
+    struct timespec now;
+    struct rusage rusage;
+    struct cgroup_usage usage;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    getrusage(RUSAGE_CHILDREN, &rusage);
+    read_cgroup_usage(&usage);
+    sample[USAGE_REAL] = TIMESPEC(now);
+    sample[USAGE_USER] = TREE(usage.user, TIMEVAL(rusage.ru_utime));
+    sample[USAGE_KERNEL] = TREE(usage.kernel, TIMEVAL(rusage.ru_stime));
+    sample[USAGE_INSTRUCTIONS] = read_counter(INSTRUCTIONS.fd);
+    sample[USAGE_MAJOR_PAGE_FAULTS] = TREE(usage.major_page_faults, rusage.ru_majflt);
+    sample[USAGE_MINOR_PAGE_FAULTS] = TREE(usage.minor_page_faults, rusage.ru_minflt);
 }
 
+/* Record the usage of a measured run, from snapshots taken before and after it.  */
 static void
-install_sigchld(void)
+record_run(const long long before[USAGE_FIELDS], const long long after[USAGE_FIELDS])
 {
-    struct sigaction sa;
-    sigemptyset(&sa.sa_mask); /* Allow concurrent calls to handler */
-    sa.sa_handler = chld;
-    sa.sa_flags = SA_RESTART; /* Restart syscalls if possible, as that's
-                                 more likely to work cleanly.  */
+    for (int field = 0; field < RUN_FIELDS; field++)
+        run_usage[field][measured_runs] = before[field] < 0 || after[field] < 0 ? -1 : after[field] - before[field];
+    measured_runs++;
+}
+
+/* A part of the runner's work, such as compiling or running the program. The runner marks the start of each phase
+   after the first by writing its name, followed by a newline, to PHASE_FD.  */
+struct phase {
+    char name[MAX_PHASE_NAME + 1];
+    long long usage[USAGE_FIELDS]; /* total over all runs; -1 if it isn't available */
+    long long max_mem; /* kilobytes; -1 if it isn't available */
+};
 
-    sigaction(SIGCHLD, &sa, NULL);
+static struct phase phases[MAX_PHASES];
+static int phase_count;
+static int current_phase;
+static bool phases_marked; /* whether the runner has marked any phases.  */
+static int memory_peak_fd = -1; /* memory.peak of the invocation's cgroup, opened for writing, if given.  */
 
-    /* We inherit the signal mask from our parent process,
-     so ensure SIGCHLD is not blocked. */
-    unblock_signal(SIGCHLD);
+/* Peak memory usage of the whole process tree in kilobytes since the last call, or -1 if it isn't known. Since Linux
+   6.12, each open file of memory.peak can be reset separately; older kernels don't let the launcher open it for
+   writing, so there is no file descriptor, and the peak of each phase is never known.  */
+static long long
+memory_peak_since_last(void)
+{
+    static bool reset_failed;
+    char buf[32];
+    if (memory_peak_fd < 0 || reset_failed)
+        return -1;
+    ssize_t n = pread(memory_peak_fd, buf, sizeof buf - 1, 0);
+    if (n <= 0)
+        return -1;
+    buf[n] = '\0';
+    if (write(memory_peak_fd, "reset\n", 6) < 0)
+        reset_failed = true;
+    return strtoll(buf, NULL, 10) / 1024;
+}
+
+/* Find the phase called NAME, adding it if there's room, or otherwise lumping it in with the last one.  */
+static int
+find_phase(const char* name)
+{
+    for (int i = 0; i < phase_count; i++)
+        if (strcmp(phases[i].name, name) == 0)
+            return i;
+    if (phase_count == MAX_PHASES)
+        return MAX_PHASES - 1;
+    struct phase* phase = &phases[phase_count];
+    snprintf(phase->name, sizeof phase->name, "%s", name);
+    memset(phase->usage, 0, sizeof phase->usage);
+    phase->max_mem = 0;
+    return phase_count++;
 }
 
+/* Add the usage between the snapshots START and END to the current phase.  */
 static void
-handle_usr1(int sig, siginfo_t *info, void *_ucontext) {
-    assert(sig == SIGUSR1);
-    union sigval sigval = info->si_value;
-    int signal = sigval.sival_int;
-    kill(monitored_pid, signal);
+end_phase(const long long start[USAGE_FIELDS], const long long end[USAGE_FIELDS])
+{
+    struct phase* phase = &phases[current_phase];
+    for (int field = 0; field < USAGE_FIELDS; field++)
+        if (phase->usage[field] >= 0)
+            phase->usage[field] = start[field] < 0 || end[field] < 0 ? -1 : phase->usage[field] + end[field] - start[field];
+    long long peak = memory_peak_since_last();
+    if (peak < 0)
+        phase->max_mem = -1;
+    else if (phase->max_mem >= 0 && peak > phase->max_mem)
+        phase->max_mem = peak;
 }
 
+/* Read the phase names which the runner has written to PIPE_FD, and start each phase in turn. PHASE_START is the
+   snapshot of usage at the start of the current phase.  */
 static void
-install_cleanup(int sigterm)
-{
-    struct sigaction sa;
-    sigemptyset(&sa.sa_mask); /* Allow concurrent calls to handler */
-    sa.sa_handler = cleanup;
-    sa.sa_flags = SA_RESTART; /* Restart syscalls if possible, as that's
-                                 more likely to work cleanly.  */
-
-    sigaction(SIGALRM, &sa, NULL); /* our timeout.  */
-    sigaction(SIGINT, &sa, NULL); /* Ctrl-C at terminal for example.  */
-    sigaction(SIGQUIT, &sa, NULL); /* Ctrl-\ at terminal for example.  */
-    sigaction(SIGHUP, &sa, NULL); /* terminal closed for example.  */
-    sigaction(SIGTERM, &sa, NULL); /* if we're killed, stop monitored proc.  */
-    sigaction(sigterm, &sa, NULL); /* user specified termination signal.  */
-}
-
-/* Block all signals which were registered with cleanup() as the signal
-   handler, so we never kill processes after waitpid() returns.
-   Also block SIGCHLD to ensure it doesn't fire between
-   waitpid() polling and sigsuspend() waiting for a signal.
-   Return original mask in OLD_SET.  */
+read_phase_markers(int pipe_fd, long long phase_start[USAGE_FIELDS])
+{
+    static char name[MAX_PHASE_NAME + 1];
+    static size_t length;
+    char buf[256];
+    ssize_t n;
+    while ((n = read(pipe_fd, buf, sizeof buf)) > 0)
+        for (ssize_t i = 0; i < n; i++) {
+            char c = buf[i];
+            if (c != '\n') {
+                /* long names are truncated, and names are kept safe to put in JSON */
+                if (length < MAX_PHASE_NAME)
+                    name[length++] = (c >= 'a' && c <= 'z') || (c >= '0' && c <= '9') || c == '-' ? c : '_';
+                continue;
+            }
+            name[length] = '\0';
+            if (length == 0)
+                continue;
+            length = 0;
+            long long now[USAGE_FIELDS];
+            take_sample(now);
+            end_phase(phase_start, now);
+            current_phase = find_phase(name);
+            memcpy(phase_start, now, sizeof now);
+            phases_marked = true;
+        }
+}
+
+/* Print the usage of each phase as a JSON array.  */
+static int
+print_phases(int fd)
+{
+    DPRINTF(fd, "%s", "[");
+    for (int i = 0; i < phase_count; i++) {
+        DPRINTF(fd, "{\"name\":\"%s\",", phases[i].name);
+        for (int field = 0; field < USAGE_FIELDS; field++)
+            DPRINTF_OPTIONAL(fd, usage_field_names[field], phases[i].usage[field]);
+        if (phases[i].max_mem < 0)
+            DPRINTF(fd, "%s", "\"max_mem\":null}");
+        else
+            DPRINTF(fd, "\"max_mem\":%lld}", phases[i].max_mem);
+        if (i + 1 < phase_count)
+            DPRINTF(fd, "%s", ",");
+    }
+    DPRINTF(fd, "%s", "]");
+    return 0;
+}
+
+static int
+compare_long_long(const void* a, const void* b)
+{
+    long long x = *(const long long*)a, y = *(const long long*)b;
+    return (x > y) - (x < y);
+}
+
+/* Print summary statistics of the N VALUES, which are sorted in place, as a JSON member called NAME. It is null if
+   there are no values, or any of them isn't available.  */
+static int
+print_statistics(int fd, const char* name, long long* values, int n)
+{
+    bool available = n > 0;
+    for (int i = 0; i < n; i++)
+        if (values[i] < 0)
+            available = false;
+    if (!available) {
+        DPRINTF(fd, "\"%s\":null", name);
+        return 0;
+    }
+    qsort(values, n, sizeof *values, compare_long_long);
+    double sum = 0, squares = 0;
+    for (int i = 0; i < n; i++)
+        sum += values[i];
+    double mean = sum / n;
+    for (int i = 0; i < n; i++)
+        squares += (values[i] - mean) * (values[i] - mean);
+    long long median = n % 2 ? values[n / 2] : (values[n / 2 - 1] + values[n / 2]) / 2;
+    long long p95 = values[(95 * n + 99) / 100 - 1]; /* nearest rank */
+    long long stddev = n > 1 ? llround(sqrt(squares / (n - 1))) : 0;
+    DPRINTF(fd, "\"%s\":{\"min\":%lld,\"median\":%lld,\"mean\":%lld,\"p95\":%lld,\"stddev\":%lld}",
+        name, values[0], median, llround(mean), p95, stddev);
+    return 0;
+}
+
+/* The profiler samples the call stack of every process in the tree on a CPU clock, and adds them up as "folded"
+   stacks, which flame graph tools take as input: one line for each distinct stack, with the process name and then
+   each function from the outermost, separated by semicolons, followed by a space and the number of samples.
+   Functions are named from the symbol tables of the ELF files mapped at their addresses, so that the runner's image
+   doesn't need any tools.  */
+
+struct symbol {
+    uint64_t address, size;
+    char* name;
+};
+
+/* The function symbols of a file, sorted by address.  */
+struct symbol_table {
+    char* path;
+    char* label; /* name used for addresses without a symbol */
+    struct symbol* symbols;
+    size_t count;
+    /* the loadable segments, which say where each part of the file is in the addresses of the symbols */
+    struct {
+        uint64_t offset, address, size;
+    } segments[8];
+    size_t segment_count;
+    struct symbol_table* next;
+};
+
+/* A file mapped into a process's memory, from a PERF_RECORD_MMAP.  */
+struct mapping {
+    uint64_t start, end, offset;
+    struct symbol_table* symbols;
+};
+
+/* A process as seen by the profiler. A process which execs gets a new entry, since it starts with a fresh address
+   space; one which forks uses its parent's mappings as well as its own.  */
+struct process {
+    pid_t pid;
+    int parent; /* index in processes, or -1 */
+    char comm[16];
+    struct mapping* mappings;
+    size_t mapping_count, mapping_capacity;
+};
+
+/* A distinct folded stack, in a hash table.  */
+struct stack {
+    char* frames;
+    long long samples;
+};
+
+static int profile_fd = -1; /* where to write the folded stacks, if profiling.  */
+static struct symbol_table* symbol_tables;
+static struct process* processes;
+static size_t process_count, process_capacity;
+static struct stack* stacks;
+static size_t stack_count, stack_capacity;
+static long long profile_lost; /* number of records the kernel had to drop because we didn't keep up */
+/* samples from the last drain, which are only added up after all the records about the processes have been read,
+   since those can come from the ring buffer of another CPU */
+static unsigned char* pending_samples;
+static size_t pending_size, pending_capacity;
+
+/* Make sure that ARRAY, of *CAPACITY elements of SIZE, has space for COUNT + 1 elements.  */
+static bool
+reserve(void** array, size_t* capacity, size_t count, size_t size)
+{
+    if (count < *capacity)
+        return true;
+    size_t new_capacity = *capacity ? *capacity : 16;
+    while (new_capacity <= count)
+        new_capacity *= 2;
+    void* new_array = realloc(*array, new_capacity * size);
+    if (new_array == NULL)
+        return false;
+    *array = new_array;
+    *capacity = new_capacity;
+    return true;
+}
+
+static int
+compare_symbols(const void* a, const void* b)
+{
+    uint64_t x = ((const struct symbol*)a)->address, y = ((const struct symbol*)b)->address;
+    return (x > y) - (x < y);
+}
+
+/* Read the function symbols and loadable segments of TABLE's file, if it's a 64-bit ELF file. The full symbol table is
+   used if the file has one, and otherwise the dynamic symbols.  */
 static void
-block_cleanup_and_chld(int sigterm, sigset_t* old_set)
+read_elf_symbols(struct symbol_table* table)
 {
-    sigset_t block_set;
-    sigemptyset(&block_set);
+    int fd = open(table->path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return;
+    struct stat st;
+    if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode) || st.st_size < (off_t)sizeof(Elf64_Ehdr)) {
+        close(fd);
+        return;
+    }
+    size_t size = st.st_size;
+    unsigned char* file = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (file == MAP_FAILED)
+        return;
+    Elf64_Ehdr* header = (Elf64_Ehdr*)file;
+    if (memcmp(header->e_ident, ELFMAG, SELFMAG) != 0 || header->e_ident[EI_CLASS] != ELFCLASS64
+        || header->e_phoff > size || header->e_phnum > (size - header->e_phoff) / sizeof(Elf64_Phdr)
+        || header->e_shoff > size || header->e_shnum > (size - header->e_shoff) / sizeof(Elf64_Shdr))
+        goto done;
 
-    sigaddset(&block_set, SIGALRM);
-    sigaddset(&block_set, SIGINT);
-    sigaddset(&block_set, SIGQUIT);
-    sigaddset(&block_set, SIGHUP);
-    sigaddset(&block_set, SIGTERM);
-    sigaddset(&block_set, sigterm);
+    Elf64_Phdr* program_headers = (Elf64_Phdr*)(file + header->e_phoff);
+    size_t max_segments = sizeof table->segments / sizeof *table->segments;
+    for (size_t i = 0; i < header->e_phnum && table->segment_count < max_segments; i++)
+        if (program_headers[i].p_type == PT_LOAD) {
+            table->segments[table->segment_count].offset = program_headers[i].p_offset;
+            table->segments[table->segment_count].address = program_headers[i].p_vaddr;
+            table->segments[table->segment_count].size = program_headers[i].p_filesz;
+            table->segment_count++;
+        }
 
-    sigaddset(&block_set, SIGCHLD);
+    Elf64_Shdr* sections = (Elf64_Shdr*)(file + header->e_shoff);
+    Elf64_Shdr* symtab = NULL;
+    for (size_t i = 0; i < header->e_shnum; i++)
+        if (sections[i].sh_type == SHT_SYMTAB || (sections[i].sh_type == SHT_DYNSYM && symtab == NULL))
+            symtab = &sections[i];
+    if (symtab == NULL || symtab->sh_link >= header->e_shnum)
+        goto done;
+    Elf64_Shdr* strtab = &sections[symtab->sh_link];
+    if (symtab->sh_offset > size || symtab->sh_size > size - symtab->sh_offset
+        || strtab->sh_offset > size || strtab->sh_size > size - strtab->sh_offset)
+        goto done;
+    Elf64_Sym* symbols = (Elf64_Sym*)(file + symtab->sh_offset);
+    size_t symbol_count = symtab->sh_size / sizeof(Elf64_Sym);
+    const char* strings = (const char*)(file + strtab->sh_offset);
+    table->symbols = malloc(symbol_count * sizeof *table->symbols);
+    if (table->symbols == NULL)
+        goto done;
+    for (size_t i = 0; i < symbol_count; i++) {
+        int type = ELF64_ST_TYPE(symbols[i].st_info);
+        if ((type != STT_FUNC && type != STT_GNU_IFUNC) || symbols[i].st_value == 0
+            || symbols[i].st_name >= strtab->sh_size
+            || memchr(strings + symbols[i].st_name, '\0', strtab->sh_size - symbols[i].st_name) == NULL)
+            continue;
+        char* name = strdup(strings + symbols[i].st_name);
+        if (name == NULL)
+            break;
+        table->symbols[table->count++] = (struct symbol){ symbols[i].st_value, symbols[i].st_size, name };
+    }
+    qsort(table->symbols, table->count, sizeof *table->symbols, compare_symbols);
+done:
+    munmap(file, size);
+}
 
-    if (sigprocmask(SIG_BLOCK, &block_set, old_set) != 0)
-        perror("warning: sigprocmask");
+/* Get the symbols of the file at PATH, reading them the first time.  */
+static struct symbol_table*
+load_symbols(const char* path)
+{
+    for (struct symbol_table* table = symbol_tables; table != NULL; table = table->next)
+        if (strcmp(table->path, path) == 0)
+            return table;
+    struct symbol_table* table = calloc(1, sizeof *table);
+    if (table == NULL)
+        return NULL;
+    /* special mappings like [vdso] are already in brackets */
+    const char* base = strrchr(path, '/');
+    base = base == NULL ? path : base + 1;
+    if (path[0] == '[' ? asprintf(&table->label, "%s", path) < 0 : asprintf(&table->label, "[%s]", base) < 0) {
+        free(table);
+        return NULL;
+    }
+    table->path = strdup(path);
+    if (table->path == NULL) {
+        free(table->label);
+        free(table);
+        return NULL;
+    }
+    read_elf_symbols(table);
+    table->next = symbol_tables;
+    symbol_tables = table;
+    return table;
 }
 
-int parse_int(char* string) {
-    int value = 0;
+/* The name of the function at file OFFSET in TABLE's file, or its label if that isn't known.  */
+static const char*
+symbol_name(const struct symbol_table* table, uint64_t offset)
+{
+    uint64_t address = offset;
+    for (size_t i = 0; i < table->segment_count; i++)
+        if (offset >= table->segments[i].offset && offset - table->segments[i].offset < table->segments[i].size) {
+            address = offset - table->segments[i].offset + table->segments[i].address;
+            break;
+        }
+    /* find the last symbol which starts at or before the address */
+    size_t low = 0, high = table->count;
+    while (low < high) {
+        size_t middle = low + (high - low) / 2;
+        if (table->symbols[middle].address <= address)
+            low = middle + 1;
+        else
+            high = middle;
+    }
+    if (low == 0)
+        return table->label;
+    const struct symbol* symbol = &table->symbols[low - 1];
+    if (symbol->size != 0 && address - symbol->address >= symbol->size)
+        return table->label;
+    return symbol->name;
+}
+
+/* The index of the latest process with PID, or -1 if there isn't one.  */
+static int
+find_process(pid_t pid)
+{
+    for (size_t i = process_count; i-- > 0;)
+        if (processes[i].pid == pid)
+            return i;
+    return -1;
+}
+
+/* Add a process with PID and COMM, which also uses the mappings of PARENT (an index, or -1).  */
+static int
+add_process(pid_t pid, int parent, const char* comm)
+{
+    if (!reserve((void**)&processes, &process_capacity, process_count, sizeof *processes))
+        return -1;
+    struct process* process = &processes[process_count];
+    *process = (struct process){ .pid = pid, .parent = parent };
+    snprintf(process->comm, sizeof process->comm, "%s", comm);
+    return process_count++;
+}
+
+/* The index of the latest process with PID, adding one if there isn't one yet.  */
+static int
+get_process(pid_t pid)
+{
+    int index = find_process(pid);
+    return index >= 0 ? index : add_process(pid, -1, "[unknown]");
+}
+
+/* The name of the function at ADDRESS in process INDEX.  */
+static const char*
+function_name(int index, uint64_t address)
+{
+    for (; index >= 0; index = processes[index].parent) {
+        const struct process* process = &processes[index];
+        for (size_t i = process->mapping_count; i-- > 0;) {
+            const struct mapping* mapping = &process->mappings[i];
+            if (address >= mapping->start && address < mapping->end)
+                return mapping->symbols == NULL
+                    ? "[unknown]" : symbol_name(mapping->symbols, address - mapping->start + mapping->offset);
+        }
+    }
+    return "[unknown]";
+}
+
+/* Add SAMPLES to the count of the folded stack FRAMES.  */
+static void
+count_stack(const char* frames, long long samples)
+{
+    if (stack_count * 2 >= stack_capacity) {
+        size_t new_capacity = stack_capacity ? stack_capacity * 2 : 1024;
+        struct stack* new_stacks = calloc(new_capacity, sizeof *new_stacks);
+        if (new_stacks == NULL)
+            return;
+        struct stack* old_stacks = stacks;
+        size_t old_capacity = stack_capacity;
+        stacks = new_stacks;
+        stack_capacity = new_capacity;
+        stack_count = 0;
+        for (size_t i = 0; i < old_capacity; i++)
+            if (old_stacks[i].frames != NULL) {
+                count_stack(old_stacks[i].frames, old_stacks[i].samples);
+                free(old_stacks[i].frames);
+            }
+        free(old_stacks);
+    }
+    uint64_t hash = 14695981039346656037ULL; /* FNV-1a */
+    for (const char* c = frames; *c; c++)
+        hash = (hash ^ (unsigned char)*c) * 1099511628211ULL;
+    size_t i = hash & (stack_capacity - 1);
+    while (stacks[i].frames != NULL && strcmp(stacks[i].frames, frames) != 0)
+        i = (i + 1) & (stack_capacity - 1);
+    if (stacks[i].frames == NULL) {
+        stacks[i].frames = strdup(frames);
+        if (stacks[i].frames == NULL)
+            return;
+        stack_count++;
+    }
+    stacks[i].samples += samples;
+}
+
+/* Append NAME to the folded stack in BUF of SIZE, which is LENGTH long so far, as another frame. Characters which
+   have a special meaning in the folded format are replaced. Returns false if it doesn't fit.  */
+static bool
+append_frame(char* buf, size_t size, size_t* length, const char* name)
+{
+    size_t name_length = strlen(name);
+    if (*length + name_length + 2 > size)
+        return false;
+    if (*length != 0)
+        buf[(*length)++] = ';';
+    for (size_t i = 0; i < name_length; i++)
+        buf[(*length)++] = name[i] == ';' || name[i] == ' ' || name[i] == '\n' ? '_' : name[i];
+    buf[*length] = '\0';
+    return true;
+}
+
+/* A PERF_RECORD_SAMPLE with PERF_SAMPLE_TID and PERF_SAMPLE_CALLCHAIN.  */
+struct profile_sample {
+    struct perf_event_header header;
+    uint32_t pid, tid;
+    uint64_t nr;
+    uint64_t ips[];
+};
+
+/* Add up SAMPLE, whose call stack starts from the innermost address.  */
+static void
+add_sample(const struct profile_sample* sample)
+{
+    static char frames[16384];
+    size_t length = 0;
+    int process = get_process(sample->pid);
+    if (process < 0)
+        return;
+    append_frame(frames, sizeof frames, &length, processes[process].comm);
+    for (uint64_t i = sample->nr; i-- > 0;) {
+        if (sample->ips[i] >= (uint64_t)PERF_CONTEXT_MAX)
+            continue; /* marks which context the addresses after it are from */
+        if (!append_frame(frames, sizeof frames, &length, function_name(process, sample->ips[i])))
+            break;
+    }
+    count_stack(frames, 1);
+}
+
+/* Handle a record from the profiler's ring buffers.  */
+static void
+handle_profile_record(struct perf_event_header* record, void* context)
+{
+    (void)context;
+    switch (record->type) {
+    case PERF_RECORD_SAMPLE: {
+        const struct profile_sample* sample = (const struct profile_sample*)record;
+        if (record->size < sizeof *sample || sample->nr > (record->size - sizeof *sample) / sizeof *sample->ips)
+            break;
+        if (!reserve((void**)&pending_samples, &pending_capacity, pending_size + record->size, 1))
+            break;
+        memcpy(pending_samples + pending_size, record, record->size);
+        pending_size += record->size;
+        break;
+    }
+    case PERF_RECORD_MMAP: {
+        const struct {
+            struct perf_event_header header;
+            uint32_t pid, tid;
+            uint64_t addr, len, pgoff;
+            char filename[];
+        }* mmap_record = (const void*)record;
+        int index = get_process(mmap_record->pid);
+        if (index < 0)
+            break;
+        struct process* process = &processes[index];
+        if (!reserve((void**)&process->mappings, &process->mapping_capacity, process->mapping_count,
+                sizeof *process->mappings))
+            break;
+        process->mappings[process->mapping_count++] = (struct mapping){
+            mmap_record->addr, mmap_record->addr + mmap_record->len, mmap_record->pgoff,
+            load_symbols(mmap_record->filename)
+        };
+        break;
+    }
+    case PERF_RECORD_COMM: {
+        const struct {
+            struct perf_event_header header;
+            uint32_t pid, tid;
+            char comm[];
+        }* comm_record = (const void*)record;
+        if (record->misc & PERF_RECORD_MISC_COMM_EXEC)
+            add_process(comm_record->pid, -1, comm_record->comm);
+        else if (comm_record->pid == comm_record->tid) {
+            int index = get_process(comm_record->pid);
+            if (index >= 0)
+                snprintf(processes[index].comm, sizeof processes[index].comm, "%s", comm_record->comm);
+        }
+        break;
+    }
+    case PERF_RECORD_FORK: {
+        const struct {
+            struct perf_event_header header;
+            uint32_t pid, ppid, tid, ptid;
+        }* fork_record = (const void*)record;
+        /* new threads have the same pid as their parent */
+        if (fork_record->pid != fork_record->ppid) {
+            int parent = find_process(fork_record->ppid);
+            add_process(fork_record->pid, parent, parent >= 0 ? processes[parent].comm : "[unknown]");
+        }
+        break;
+    }
+    case PERF_RECORD_LOST: {
+        const struct {
+            struct perf_event_header header;
+            uint64_t id, lost;
+        }* lost_record = (const void*)record;
+        profile_lost += lost_record->lost;
+        break;
+    }
+    }
+}
+
+/* Read everything from the profiler's ring buffers.  */
+static void
+drain_profiler(struct sampler* profiler)
+{
+    drain_sampler(profiler, handle_profile_record, NULL);
+    for (size_t offset = 0; offset < pending_size;) {
+        const struct profile_sample* sample = (const struct profile_sample*)(pending_samples + offset);
+        add_sample(sample);
+        offset += sample->header.size;
+    }
+    pending_size = 0;
+}
+
+/* Open a sampler on the CPU clock which records the call stack of every process in the tree, and the processes
+   and mappings needed to make sense of them.  */
+static int
+open_profiler(struct sampler* profiler)
+{
+    struct perf_event_attr attr = {
+        .size = sizeof attr,
+        .type = PERF_TYPE_SOFTWARE,
+        .config = PERF_COUNT_SW_CPU_CLOCK,
+        .sample_freq = PROFILE_FREQUENCY,
+        .freq = 1,
+        .sample_type = PERF_SAMPLE_TID | PERF_SAMPLE_CALLCHAIN,
+        .disabled = 1,
+        .inherit = 1,
+        .enable_on_exec = 1,
+        .exclude_kernel = 1,
+        .exclude_hv = 1,
+        .exclude_callchain_kernel = 1,
+        .mmap = 1,
+        .comm = 1,
+        .comm_exec = 1,
+        .task = 1,
+        .watermark = 1,
+        .wakeup_watermark = PROFILE_RING_PAGES * sysconf(_SC_PAGESIZE) / 4,
+    };
+    return open_sampler(profiler, &attr, PROFILE_RING_PAGES);
+}
+
+static int
+compare_stacks(const void* a, const void* b)
+{
+    long long x = (*(struct stack* const*)a)->samples, y = (*(struct stack* const*)b)->samples;
+    return (x < y) - (x > y);
+}
+
+/* Write the folded stacks to FD, most common first, up to PROFILE_MAX_BYTES.  */
+static int
+write_profile(int fd)
+{
+    struct stack** sorted = malloc((stack_count + 1) * sizeof *sorted);
+    if (sorted == NULL) {
+        perror("wrapper: writing profile");
+        return 1;
+    }
+    size_t count = 0;
+    for (size_t i = 0; i < stack_capacity; i++)
+        if (stacks[i].frames != NULL)
+            sorted[count++] = &stacks[i];
+    qsort(sorted, count, sizeof *sorted, compare_stacks);
+    size_t written = 0;
+    for (size_t i = 0; i < count; i++) {
+        written += strlen(sorted[i]->frames) + 22;
+        if (written > PROFILE_MAX_BYTES)
+            break;
+        DPRINTF(fd, "%s %lld\n", sorted[i]->frames, sorted[i]->samples);
+    }
+    if (profile_lost != 0)
+        DPRINTF(fd, "[lost] %lld\n", profile_lost);
+    free(sorted);
+    return 0;
+}
+
+/* The trace of the process tree: when each process was forked, exec'd a new program, and exited, on the same clock as
+   the timestamps which the sandbox launcher passes in, so that the time taken by each layer between the launcher
+   starting and the program getting control can be worked out.  */
+struct trace_event {
+    long long time;
+    const char* type; /* "fork", "exec" or "exit" */
+    pid_t pid;
+    pid_t parent; /* for forks */
+    char comm[16]; /* for execs */
+};
+
+static bool tracing; /* whether the events are being traced; the timestamps are printed anyway */
+static long long launcher_start, bwrap_exec, wrapper_start; /* CLOCK_MONOTONIC, in ns */
+static struct trace_event trace[TRACE_EVENTS];
+static int trace_length;
+static long long trace_lost; /* events which didn't fit, or which the kernel dropped */
+
+static void
+handle_trace_record(struct perf_event_header* record, void* context)
+{
+    (void)context;
+    struct trace_event event = { 0 };
+    /* sample_id_all puts the pid, tid and time at the end of every record */
+    const struct {
+        uint32_t pid, tid;
+        uint64_t time;
+    }* sample_id = (const void*)((const char*)record + record->size - sizeof *sample_id);
+    switch (record->type) {
+    case PERF_RECORD_COMM: {
+        const struct {
+            struct perf_event_header header;
+            uint32_t pid, tid;
+            char comm[];
+        }* comm_record = (const void*)record;
+        if (!(record->misc & PERF_RECORD_MISC_COMM_EXEC))
+            return;
+        event.type = "exec";
+        event.pid = comm_record->pid;
+        snprintf(event.comm, sizeof event.comm, "%s", comm_record->comm);
+        break;
+    }
+    case PERF_RECORD_FORK:
+    case PERF_RECORD_EXIT: {
+        const struct {
+            struct perf_event_header header;
+            uint32_t pid, ppid, tid, ptid;
+        }* task_record = (const void*)record;
+        /* only whole processes, not threads */
+        if (task_record->pid != task_record->tid)
+            return;
+        event.type = record->type == PERF_RECORD_FORK ? "fork" : "exit";
+        event.pid = task_record->pid;
+        event.parent = task_record->ppid;
+        break;
+    }
+    case PERF_RECORD_LOST: {
+        const struct {
+            struct perf_event_header header;
+            uint64_t id, lost;
+        }* lost_record = (const void*)record;
+        trace_lost += lost_record->lost;
+        return;
+    }
+    default:
+        return;
+    }
+    event.time = sample_id->time;
+    if (trace_length == TRACE_EVENTS)
+        trace_lost++;
+    else
+        trace[trace_length++] = event;
+}
+
+/* Open a sampler which records nothing but the forks, execs and exits of the whole tree, timestamped with
+   CLOCK_MONOTONIC.  */
+static int
+open_tracer(struct sampler* tracer)
+{
+    struct perf_event_attr attr = {
+        .size = sizeof attr,
+        .type = PERF_TYPE_SOFTWARE,
+        .config = PERF_COUNT_SW_DUMMY,
+        .sample_type = PERF_SAMPLE_TID | PERF_SAMPLE_TIME,
+        .inherit = 1,
+        .exclude_kernel = 1,
+        .exclude_hv = 1,
+        .comm = 1,
+        .comm_exec = 1,
+        .task = 1,
+        .sample_id_all = 1,
+        .use_clockid = 1,
+        .clockid = CLOCK_MONOTONIC,
+        .watermark = 1,
+        .wakeup_watermark = RING_PAGES * sysconf(_SC_PAGESIZE) / 2,
+    };
+    return open_sampler(tracer, &attr, RING_PAGES);
+}
+
+static int
+compare_trace_events(const void* a, const void* b)
+{
+    long long x = ((const struct trace_event*)a)->time, y = ((const struct trace_event*)b)->time;
+    return (x > y) - (x < y);
+}
+
+/* Write the trace as a JSON object, with the events in order; the ring buffers of different CPUs aren't.  */
+static int
+print_trace(int fd)
+{
+    DPRINTF(fd, "{\"launcher_start\":%lld,\"bwrap_exec\":%lld,\"wrapper_start\":%lld,", launcher_start, bwrap_exec,
+        wrapper_start);
+    if (!tracing) {
+        DPRINTF(fd, "%s", "\"lost\":0,\"events\":null}");
+        return 0;
+    }
+    qsort(trace, trace_length, sizeof *trace, compare_trace_events);
+    DPRINTF(fd, "\"lost\":%lld,\"events\":[", trace_lost);
+    for (int i = 0; i < trace_length; i++) {
+        DPRINTF(fd, "%s{\"time\":%lld,\"type\":\"%s\",\"pid\":%d", i == 0 ? "" : ",", trace[i].time, trace[i].type,
+            (int)trace[i].pid);
+        if (strcmp(trace[i].type, "fork") == 0)
+            DPRINTF(fd, ",\"parent\":%d", (int)trace[i].parent);
+        else if (strcmp(trace[i].type, "exec") == 0) {
+            /* process names are chosen by the program, so they have to be escaped */
+            char comm[sizeof trace[i].comm * 6];
+            size_t length = 0;
+            for (const char* c = trace[i].comm; *c; c++) {
+                if (*c == '"' || *c == '\\')
+                    length += sprintf(comm + length, "\\%c", *c);
+                else if ((unsigned char)*c < 0x20)
+                    length += sprintf(comm + length, "\\u%04x", *c);
+                else
+                    comm[length++] = *c;
+            }
+            comm[length] = 0;
+            DPRINTF(fd, ",\"comm\":\"%s\"", comm);
+        }
+        DPRINTF(fd, "%s", "}");
+    }
+    DPRINTF(fd, "%s", "]}");
+    return 0;
+}
+
+struct exec_spec_header {
+    char magic[4];
+    uint32_t version;
+    uint32_t argc;
+    uint32_t envc;
+    uint32_t strings_size;
+};
+
+static char** runner_env; /* the image's environment, which the runner is given; ours if it is NULL.  */
+
+/* Load the environment from the exec-spec at PATH into runner_env. The spec is a header followed by ARGC + ENVC + 1
+   null-terminated strings: bwrap's arguments, which were for the launcher, then the environment, then the working
+   directory. It is mapped rather than read, and the strings are used in place. On failure, return -1 and set errno.  */
+static int
+load_runner_env(const char* path)
+{
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return -1;
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        close(fd);
+        return -1;
+    }
+    size_t size = st.st_size;
+    struct exec_spec_header header;
+    char* buf = MAP_FAILED;
+    if (size > sizeof header)
+        buf = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (buf == MAP_FAILED)
+        goto invalid;
+    memcpy(&header, buf, sizeof header);
+    if (memcmp(header.magic, EXEC_SPEC_MAGIC, sizeof header.magic) != 0 || header.version != EXEC_SPEC_VERSION
+        || header.strings_size != size - sizeof header || header.envc > header.strings_size || buf[size - 1] != 0)
+        goto invalid;
+    runner_env = calloc((size_t)header.envc + 1, sizeof *runner_env);
+    if (runner_env == NULL)
+        return -1;
+    char* string = buf + sizeof header;
+    char* end = buf + size;
+    for (size_t i = 0; i < (size_t)header.argc + header.envc; i++) {
+        if (string >= end)
+            goto invalid;
+        if (i >= header.argc)
+            runner_env[i - header.argc] = string;
+        /* the file ends with a null byte, so there is always one */
+        string = (char*)memchr(string, 0, end - string) + 1;
+    }
+    return 0;
+
+invalid:
+    free(runner_env);
+    runner_env = NULL;
+    errno = EINVAL;
+    return -1;
+}
+
+/* What the child needs to set itself up to exec the runner. Until the exec, it shares our memory, and we are suspended,
+   so it mustn't change anything else, and it must leave with _exit.  */
+struct spawn_args {
+    const sigset_t* old_set;
+    int status_fd;
+    int phase_fd;
+    bool give_phase_fd; /* whether the runner marks phases, and so gets the pipe as PHASE_FD.  */
+    bool reopen_input;
+};
+
+static int
+spawn_runner(void* arg)
+{
+    const struct spawn_args* args = arg;
+    /* exec doesn't reset SIG_IGN -> SIG_DFL, or the signal mask.  */
+    signal(SIGTTIN, SIG_DFL);
+    signal(SIGTTOU, SIG_DFL);
+    sigprocmask(SIG_SETMASK, args->old_set, NULL);
+
+    close(args->status_fd);
+    if (!args->give_phase_fd) {
+        /* otherwise the program could forge phase markers, or keep the pipe open after the runner exits */
+        close(PHASE_FD);
+    } else if (dup2(args->phase_fd, PHASE_FD) < 0
+        || (args->phase_fd == PHASE_FD && fcntl(PHASE_FD, F_SETFD, 0) < 0)) {
+        perror("wrapper: phase pipe");
+        _exit(1);
+    }
+    if (args->reopen_input) {
+        /* every run gets the input from the beginning */
+        int input_fd = open("/ATO/input", O_RDONLY);
+        if (input_fd < 0 || dup2(input_fd, STDIN_FILENO) < 0) {
+            perror("wrapper: opening input");
+            _exit(1);
+        }
+        close(input_fd);
+    }
+    char* const runner_argv[] = { "/ATO/runner", NULL };
+    execve("/ATO/runner", runner_argv, runner_env != NULL ? runner_env : environ);
+    perror("execve");
+    _exit(1);
+}
+
+/* Add FD to the epoll set, tagged with SOURCE.  */
+static int
+watch(int epoll_fd, int fd, enum event_source source)
+{
+    struct epoll_event event = { .events = EPOLLIN, .data.u32 = source };
+    return epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event);
+}
+
+/* The signals which we forward to the child. They are blocked and read
+   through a signalfd instead of being handled asynchronously.  */
+static void
+cleanup_signals(sigset_t* set, int sigterm)
+{
+    sigemptyset(set);
+    sigaddset(set, SIGINT); /* Ctrl-C at terminal for example.  */
+    sigaddset(set, SIGQUIT); /* Ctrl-\ at terminal for example.  */
+    sigaddset(set, SIGHUP); /* terminal closed for example.  */
+    sigaddset(set, SIGTERM); /* if we're killed, stop monitored proc.  */
+    sigaddset(set, SIGUSR1); /* kill the child with the signal given in si_value.  */
+    sigaddset(set, sigterm); /* user specified termination signal.  */
+}
+
+long long parse_long(char* string) {
+    long long value = 0;
     if (string[0] < '1') {
         // invalid integer (must be >= 0)
         exit(2);
     }
     for (int i = 0; string[i]; i++) {
-        if (string[i] < '0' || string[i] > '9') {
+        if (string[i] < '0' || string[i] > '9' || i >= 18) {
             // invalid integer
             exit(2);
         }
@@ -245,15 +1643,117 @@ int parse_int(char* string) {
     return value;
 }
 
+int parse_int(char* string) {
+    long long value = parse_long(string);
+    if (value > INT_MAX) {
+        exit(2);
+    }
+    return value;
+}
+
 int main(int argc, char** argv)
 {
-    if (argc != 3) {
+    // usage: wrapper [-b RUN_BUDGET_MS] [-c CPU_TIME_MS] [-e EXEC_SPEC] [-f] [-g CGROUP_DIR] [-i INSTRUCTIONS]
+    //   [-m MEMORY_PEAK_FD] [-n RUNS] [-p PROFILE_FD] [-t TIMELINE_INTERVAL_MS] [-w WARMUP_RUNS]
+    //   [-x LAUNCHER_START,BWRAP_EXEC] FD TIMEOUT_MS
+    // With -e, the runner gets the environment from the image's exec-spec, rather than ours. Only with -f does it get
+    // the phase pipe, as file descriptor 3.
+    struct timespec started;
+    clock_gettime(CLOCK_MONOTONIC, &started);
+    wrapper_start = TIMESPEC(started);
+    int opt;
+    bool runs_given = false, give_phase_fd = false;
+    int timeline_interval_ms = 0;
+    while ((opt = getopt(argc, argv, "+b:c:e:fg:i:m:n:p:t:w:x:")) != -1) {
+        switch (opt) {
+        case 'b':
+            run_budget_ms = parse_int(optarg);
+            break;
+        case 'c':
+            cpu_time_ms = parse_int(optarg);
+            break;
+        case 'e':
+            if (load_runner_env(optarg) < 0) {
+                perror("wrapper: load exec-spec");
+                return 1;
+            }
+            break;
+        case 'i':
+            instruction_limit = parse_long(optarg);
+            break;
+        case 'm':
+            memory_peak_fd = parse_int(optarg);
+            if (fcntl(memory_peak_fd, F_SETFD, FD_CLOEXEC) < 0) {
+                perror("wrapper: memory.peak");
+                memory_peak_fd = -1;
+            }
+            break;
+        case 'p':
+            profile_fd = parse_int(optarg);
+            if (fcntl(profile_fd, F_SETFD, FD_CLOEXEC) < 0) {
+                perror("wrapper: profile");
+                return 1;
+            }
+            break;
+        case 'n':
+            runs = parse_int(optarg);
+            runs_given = true;
+            break;
+        case 't':
+            timeline_interval_ms = parse_int(optarg);
+            break;
+        case 'w':
+            warmup_runs = parse_int(optarg);
+            break;
+        case 'x': {
+            // the times at which the sandbox launcher started, and exec'd bwrap
+            char* separator = strchr(optarg, ',');
+            if (separator == NULL)
+                return 2;
+            *separator = 0;
+            launcher_start = parse_long(optarg);
+            bwrap_exec = parse_long(separator + 1);
+            tracing = true;
+            break;
+        }
+        case 'f':
+            give_phase_fd = true;
+            break;
+        case 'g':
+            cgroup_fd = open(optarg, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+            if (cgroup_fd < 0) {
+                perror("wrapper: open cgroup");
+                return 1;
+            }
+            break;
+        default:
+            return 2;
+        }
+    }
+    if (argc - optind != 2) {
         // file descriptor and timeout must be given as argument
         return 2;
     }
-    int fd = parse_int(argv[1]);
-    timeout_secs = parse_int(argv[2]);
-    if (timeout_secs < 1 || timeout_secs > MAX_TIMEOUT_SECS) {
+    int fd = parse_int(argv[optind]);
+    timeout_ms = parse_int(argv[optind + 1]);
+    if (timeout_ms < 1 || timeout_ms > MAX_TIMEOUT_MS) {
+        return 2;
+    }
+    if (cpu_time_ms != 0 && (cpu_time_ms > MAX_TIMEOUT_MS || cgroup_fd < 0)) {
+        // the CPU time of the whole process tree can only be measured through its cgroup
+        return 2;
+    }
+    if (timeline_interval_ms != 0 && (timeline_interval_ms < MIN_TIMELINE_INTERVAL_MS
+        || timeline_interval_ms > MAX_TIMELINE_INTERVAL_MS || cgroup_fd < 0)) {
+        // the timeline is also measured through the cgroup
+        return 2;
+    }
+    timeline_interval_ns = timeline_interval_ms * 1000000LL;
+    if (run_budget_ms != 0 && !runs_given) {
+        // run as many times as fit in the budget
+        runs = MAX_RUNS;
+    }
+    if (runs < 1 || runs > MAX_RUNS || warmup_runs > MAX_RUNS || run_budget_ms > MAX_TIMEOUT_MS) {
         return 2;
     }
 
@@ -264,21 +1764,72 @@ int main(int argc, char** argv)
         return errno;
     }
 
-    preserve_status = true;
+    struct stat pid_namespace;
+    own_pid_namespace = stat("/proc/self/ns/pid", &pid_namespace) == 0
+        && pid_namespace.st_ino != INITIAL_PID_NAMESPACE;
 
-    /* Ensure we're in our own group so all subprocesses can be killed.
+    /* Ensure we're in our own group, like a shell starting a job (the tree
+     is killed through our PID namespace, see kill_tree).
      Note we don't just put the child in a separate group as
      then we would need to worry about foreground and background groups
      and propagating signals between them.  */
     if (!foreground)
         setpgid(0, 0);
 
-    /* Setup handlers before fork() so that we
+    /* Block the signals we forward before fork() so that we
      handle any signals caused by child, without races.  */
-    install_cleanup(term_signal);
+    sigset_t cleanup_set, old_set;
+    cleanup_signals(&cleanup_set, term_signal);
+    if (sigprocmask(SIG_BLOCK, &cleanup_set, &old_set) != 0) {
+        perror("sigprocmask");
+        return 1;
+    }
     signal(SIGTTIN, SIG_IGN); /* Don't stop if background child needs tty.  */
     signal(SIGTTOU, SIG_IGN); /* Don't stop if background child needs tty.  */
-    install_sigchld(); /* Interrupt sigsuspend() when child exits.   */
+
+    int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    int signal_fd = signalfd(-1, &cleanup_set, SFD_CLOEXEC);
+    int timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+    int cpu_timer_fd = -1, cpu_stat_fd = -1, timeline_timer_fd = -1;
+    if (cpu_time_ms != 0) {
+        cpu_timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+        cpu_stat_fd = openat(cgroup_fd, "cpu.stat", O_RDONLY | O_CLOEXEC);
+    }
+    if (timeline_interval_ns != 0)
+        timeline_timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+    if (epoll_fd < 0 || signal_fd < 0 || timer_fd < 0
+        || (cpu_time_ms != 0 && (cpu_timer_fd < 0 || cpu_stat_fd < 0))
+        || (timeline_interval_ns != 0 && (timeline_timer_fd < 0 || open_timeline() < 0))) {
+        perror("wrapper: setting up event loop");
+        return 1;
+    }
+    long long cpu_baseline = cpu_time_ms != 0 ? cgroup_cpu_time(cpu_stat_fd) : 0;
+
+    struct cgroup_usage cgroup_baseline, cgroup_usage;
+    read_cgroup_usage(&cgroup_baseline);
+    open_counters();
+    struct sampler instruction_sampler;
+    if (instruction_limit != 0 && (INSTRUCTIONS.fd < 0 || open_instruction_sampler(&instruction_sampler) < 0)) {
+        /* reported in the status rather than to the program's stderr, so that the client can tell */
+        limit_unavailable = "instructions";
+        instruction_limit = 0;
+    }
+    int instruction_timer_fd = -1;
+    if (instruction_limit != 0 && (instruction_timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC)) < 0) {
+        perror("wrapper: setting up event loop");
+        return 1;
+    }
+    struct sampler profiler;
+    if (profile_fd >= 0 && open_profiler(&profiler) < 0) {
+        perror("wrapper: warning: the program can't be profiled on this server");
+        close(profile_fd);
+        profile_fd = -1;
+    }
+    struct sampler tracer;
+    if (tracing && open_tracer(&tracer) < 0) {
+        perror("wrapper: warning: the process tree can't be traced on this server");
+        tracing = false;
+    }
 
     struct timespec start_time;
     int result = clock_gettime(CLOCK_MONOTONIC, &start_time);
@@ -287,51 +1838,172 @@ int main(int argc, char** argv)
         return 1;
     }
 
-    monitored_pid = fork();
-    if (monitored_pid == -1) {
-        perror("fork system call failed");
-        return 2;
-    } else if (monitored_pid == 0) { /* child */
-        /* exec doesn't reset SIG_IGN -> SIG_DFL.  */
-        signal(SIGTTIN, SIG_DFL);
-        signal(SIGTTOU, SIG_DFL);
+    int phase_pipe[2];
+    if (pipe2(phase_pipe, O_CLOEXEC) < 0 || fcntl(phase_pipe[0], F_SETFL, O_NONBLOCK) < 0) {
+        perror("wrapper: phase pipe");
+        return 1;
+    }
 
-        close(fd);
-        execlp("/ATO/runner", "/ATO/runner", (char*)NULL);
-        perror("execlp");
+    if (settimeout(timer_fd, start_time, timeout_ms * 1000000LL) < 0
+        || watch(epoll_fd, timer_fd, EVENT_TIMER) < 0
+        || watch(epoll_fd, phase_pipe[0], EVENT_PHASE) < 0
+        || watch(epoll_fd, signal_fd, EVENT_SIGNAL) < 0
+        || (cpu_time_ms != 0 && watch(epoll_fd, cpu_timer_fd, EVENT_CPU_TIMER) < 0)
+        || (instruction_limit != 0 && (setinterval(instruction_timer_fd, INSTRUCTION_POLL_NS) < 0
+            || watch(epoll_fd, instruction_timer_fd, EVENT_INSTRUCTION_TIMER) < 0))
+        || (timeline_interval_ns != 0 && (setinterval(timeline_timer_fd, timeline_interval_ns) < 0
+            || watch(epoll_fd, timeline_timer_fd, EVENT_TIMELINE) < 0))) {
+        perror("wrapper: setting up event loop");
         return 1;
-    } else {
-        pid_t wait_result;
-        int status;
-        struct rusage rusage;
-        char* status_type = "unknown";
-
-        /* We configure timers so that SIGALRM is sent on expiry.
-         Therefore ensure we don't inherit a mask blocking SIGALRM.  */
-        unblock_signal(SIGALRM);
-
-        /* setup handler for kill-child-process signal */
-        struct sigaction sa;
-        sigemptyset(&sa.sa_mask);
-        sa.sa_sigaction = handle_usr1;
-        sa.sa_flags = SA_SIGINFO;
-        int err = sigaction(SIGUSR1, &sa, NULL);
-        if (err < 0) {
-            perror("sigaction");
-        }
+    }
+    if (timeline_interval_ns != 0)
+        sample_timeline(timeline_timer_fd, 0);
+    if (cpu_time_ms != 0)
+        check_cpu_time(cpu_timer_fd, cpu_stat_fd, cpu_baseline);
+    for (int cpu = 0; instruction_limit != 0 && cpu < instruction_sampler.cpus; cpu++) {
+        int sampler_fd = instruction_sampler.fds[cpu];
+        if (sampler_fd >= 0 && watch(epoll_fd, sampler_fd, EVENT_INSTRUCTIONS) < 0)
+            perror("warning: watching instruction count");
+    }
+    for (int cpu = 0; profile_fd >= 0 && cpu < profiler.cpus; cpu++) {
+        int sampler_fd = profiler.fds[cpu];
+        if (sampler_fd >= 0 && watch(epoll_fd, sampler_fd, EVENT_PROFILE) < 0)
+            perror("warning: watching profiler");
+    }
+    for (int cpu = 0; tracing && cpu < tracer.cpus; cpu++) {
+        int sampler_fd = tracer.fds[cpu];
+        if (sampler_fd >= 0 && watch(epoll_fd, sampler_fd, EVENT_TRACE) < 0)
+            perror("warning: watching tracer");
+    }
+
+    pid_t wait_result;
+    int status;
+    struct rusage rusage;
+    char* status_type = "unknown";
 
-        settimeout(true);
+    char* spawn_stack = mmap(NULL, SPAWN_STACK_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK,
+        -1, 0);
+    if (spawn_stack == MAP_FAILED) {
+        perror("wrapper: allocating stack");
+        return 1;
+    }
+    struct spawn_args spawn_args = { &old_set, fd, phase_pipe[1], give_phase_fd, warmup_runs + runs > 1 };
 
-        /* Ensure we don't cleanup() after waitpid() reaps the child,
-         to avoid sending signals to a possibly different process.  */
-        sigset_t cleanup_set;
-        block_cleanup_and_chld(term_signal, &cleanup_set);
+    /* Each run is a new process with its own pidfd. We stop after the first run which doesn't succeed, since its usage
+     isn't comparable with the others.  */
+    for (int run = 0; run < warmup_runs + runs; run++) {
+        /* the measurement of a run only covers its last phase, so that compiling isn't included */
+        long long phase_start[USAGE_FIELDS], after[USAGE_FIELDS];
+        take_sample(phase_start);
+        current_phase = find_phase(FIRST_PHASE);
 
-        while ((wait_result = waitpid(monitored_pid, &status, WNOHANG)) == 0)
-            sigsuspend(&cleanup_set); /* Wait with cleanup signals unblocked.  */
+        /* CLONE_VFORK means this only returns once the child has exec'd (or given up), so the time it takes is the
+         whole cost of starting the runner */
+        struct timespec spawn_start, spawn_end;
+        clock_gettime(CLOCK_MONOTONIC, &spawn_start);
+        monitored_pid = clone(spawn_runner, spawn_stack + SPAWN_STACK_SIZE,
+            CLONE_VM | CLONE_VFORK | CLONE_PIDFD | SIGCHLD, &spawn_args, &monitored_pidfd);
+        clock_gettime(CLOCK_MONOTONIC, &spawn_end);
+        if (monitored_pid == -1) {
+            perror("clone system call failed");
+            return 2;
+        }
+        long long spawn_latency = TIMESPEC(spawn_end) - TIMESPEC(spawn_start);
+        if (run == 0)
+            first_spawn_latency = spawn_latency;
 
-        struct timespec end_time;
-        result = clock_gettime(CLOCK_MONOTONIC, &end_time);
+        bool exited = false;
+        if (watch(epoll_fd, monitored_pidfd, EVENT_CHILD) < 0) {
+            perror("wrapper: setting up event loop");
+            send_sig(SIGKILL);
+            exited = true;
+        }
+
+        while (!exited) {
+            struct epoll_event events[8];
+            int n = epoll_wait(epoll_fd, events, sizeof events / sizeof *events, -1);
+            if (n < 0) {
+                if (errno == EINTR)
+                    continue;
+                /* shouldn't happen.  */
+                perror("epoll_wait");
+                send_sig(SIGKILL);
+                break;
+            }
+            for (int i = 0; i < n; i++) {
+                switch (events[i].data.u32) {
+                case EVENT_CHILD:
+                    exited = true;
+                    break;
+                case EVENT_TIMER: {
+                    uint64_t expirations;
+                    if (read(timer_fd, &expirations, sizeof expirations) > 0 && !timed_out) {
+                        timed_out = 1;
+                        limit = "wall_time";
+                        kill_tree(term_signal);
+                    }
+                    break;
+                }
+                case EVENT_INSTRUCTIONS:
+                    drain_sampler(&instruction_sampler, NULL, NULL);
+                    check_instruction_limit();
+                    break;
+                case EVENT_INSTRUCTION_TIMER: {
+                    uint64_t expirations;
+                    if (read(instruction_timer_fd, &expirations, sizeof expirations) > 0)
+                        check_instruction_limit();
+                    break;
+                }
+                case EVENT_PROFILE:
+                    drain_profiler(&profiler);
+                    break;
+                case EVENT_TRACE:
+                    drain_sampler(&tracer, handle_trace_record, NULL);
+                    break;
+                case EVENT_TIMELINE: {
+                    uint64_t expirations;
+                    struct timespec now;
+                    if (read(timeline_timer_fd, &expirations, sizeof expirations) > 0) {
+                        clock_gettime(CLOCK_MONOTONIC, &now);
+                        sample_timeline(timeline_timer_fd, TIMESPEC(now) - TIMESPEC(start_time));
+                    }
+                    break;
+                }
+                case EVENT_PHASE:
+                    read_phase_markers(phase_pipe[0], phase_start);
+                    break;
+                case EVENT_CPU_TIMER: {
+                    uint64_t expirations;
+                    if (read(cpu_timer_fd, &expirations, sizeof expirations) > 0)
+                        check_cpu_time(cpu_timer_fd, cpu_stat_fd, cpu_baseline);
+                    break;
+                }
+                case EVENT_SIGNAL: {
+                    struct signalfd_siginfo info;
+                    if (read(signal_fd, &info, sizeof info) == sizeof info) {
+                        /* SIGUSR1 carries the signal to send in its value.  */
+                        send_sig(info.ssi_signo == SIGUSR1 ? info.ssi_int : info.ssi_signo);
+                        interrupted = true;
+                    }
+                    break;
+                }
+                }
+            }
+        }
+
+        /* The pidfd is readable, so the child is a zombie and this won't block.  */
+        while ((wait_result = waitpid(monitored_pid, &status, 0)) < 0 && errno == EINTR)
+            ;
+        /* closing it also removes it from the epoll set */
+        close(monitored_pidfd);
+        monitored_pidfd = -1;
+        read_phase_markers(phase_pipe[0], phase_start);
+        take_sample(after);
+        if (profile_fd >= 0)
+            drain_profiler(&profiler);
+        if (tracing)
+            drain_sampler(&tracer, handle_trace_record, NULL);
+        end_phase(phase_start, after);
 
         if (wait_result < 0) {
             /* shouldn't happen.  */
@@ -352,28 +2024,105 @@ int main(int argc, char** argv)
             }
         }
 
-        result = getrusage(RUSAGE_CHILDREN, &rusage);
-        if (result == -1) {
-            perror("getrusage");
-            return 1;
+        if (timed_out || interrupted || instruction_limit_reached() || strcmp(status_type, "exited") != 0
+            || status != 0)
+            break;
+        if (run >= warmup_runs) {
+            spawn_latencies[measured_runs] = spawn_latency;
+            record_run(phase_start, after);
         }
+        if (run_budget_ms != 0 && after[USAGE_REAL] - TIMESPEC(start_time) >= run_budget_ms * 1000000LL)
+            break;
+    }
 
-        DPRINTF(fd, "%s", "{");
-        DPRINTF(fd, "\"timed_out\":%s,", timed_out ? "true" : "false");
-        DPRINTF(fd, "\"status_type\":\"%s\",", status_type);
-        DPRINTF(fd, "\"status_value\":%d,", status);
-        DPRINTF(fd, "\"user\":%lld,", TIMEVAL(rusage.ru_utime));
-        DPRINTF(fd, "\"kernel\":%lld,", TIMEVAL(rusage.ru_stime));
-        DPRINTF(fd, "\"real\":%lld,", TIMESPEC(end_time) - TIMESPEC(start_time));
-        DPRINTF(fd, "\"max_mem\":%ld,", rusage.ru_maxrss);
-        DPRINTF(fd, "\"major_page_faults\":%ld,", rusage.ru_majflt);
-        DPRINTF(fd, "\"minor_page_faults\":%ld,", rusage.ru_minflt);
-        DPRINTF(fd, "\"input_ops\":%ld,", rusage.ru_inblock);
-        DPRINTF(fd, "\"output_ops\":%ld,", rusage.ru_oublock);
-        DPRINTF(fd, "\"waits\":%ld,", rusage.ru_nvcsw);
-        DPRINTF(fd, "\"preemptions\":%ld", rusage.ru_nivcsw);
-        DPRINTF(fd, "%s\n", "}");
+    struct timespec end_time;
+    result = clock_gettime(CLOCK_MONOTONIC, &end_time);
+    if (timeline_interval_ns != 0)
+        sample_timeline(-1, TIMESPEC(end_time) - TIMESPEC(start_time));
 
-        return 0;
+    /* Decide on the instruction limit from the final count, so that the verdict doesn't depend on whether the
+     process happened to exit before we got round to killing it.  */
+    if (instruction_limit_reached()) {
+        timed_out = 1;
+        limit = "instructions";
+        status_type = "instruction_limit";
     }
+
+    result = getrusage(RUSAGE_CHILDREN, &rusage);
+    if (result == -1) {
+        perror("getrusage");
+        return 1;
+    }
+    read_cgroup_usage(&cgroup_usage);
+    subtract_cgroup_usage(&cgroup_usage, &cgroup_baseline);
+
+    DPRINTF(fd, "%s", "{");
+    DPRINTF(fd, "\"timed_out\":%s,", timed_out ? "true" : "false");
+    if (limit)
+        DPRINTF(fd, "\"limit\":\"%s\",", limit);
+    else
+        DPRINTF(fd, "%s", "\"limit\":null,");
+    if (limit_unavailable)
+        DPRINTF(fd, "\"limit_unavailable\":\"%s\",", limit_unavailable);
+    else
+        DPRINTF(fd, "%s", "\"limit_unavailable\":null,");
+    DPRINTF(fd, "\"status_type\":\"%s\",", status_type);
+    DPRINTF(fd, "\"status_value\":%d,", status);
+    DPRINTF(fd, "\"user\":%lld,", TREE(cgroup_usage.user, TIMEVAL(rusage.ru_utime)));
+    DPRINTF(fd, "\"kernel\":%lld,", TREE(cgroup_usage.kernel, TIMEVAL(rusage.ru_stime)));
+    DPRINTF(fd, "\"real\":%lld,", TIMESPEC(end_time) - TIMESPEC(start_time));
+    DPRINTF(fd, "\"max_mem\":%lld,", TREE(cgroup_usage.max_mem, rusage.ru_maxrss));
+    DPRINTF(fd, "\"major_page_faults\":%lld,", TREE(cgroup_usage.major_page_faults, rusage.ru_majflt));
+    DPRINTF(fd, "\"minor_page_faults\":%lld,", TREE(cgroup_usage.minor_page_faults, rusage.ru_minflt));
+    DPRINTF(fd, "\"input_ops\":%lld,", TREE(cgroup_usage.input_ops, rusage.ru_inblock));
+    DPRINTF(fd, "\"output_ops\":%lld,", TREE(cgroup_usage.output_ops, rusage.ru_oublock));
+    DPRINTF_OPTIONAL(fd, "read_bytes", cgroup_usage.read_bytes);
+    DPRINTF_OPTIONAL(fd, "write_bytes", cgroup_usage.write_bytes);
+    DPRINTF_OPTIONAL(fd, "oom_kills", cgroup_usage.oom_kills);
+    DPRINTF_OPTIONAL(fd, "memory_high_events", cgroup_usage.memory_high_events);
+    DPRINTF_OPTIONAL(fd, "memory_max_events", cgroup_usage.memory_max_events);
+    for (size_t i = 0; i < COUNTERS; i++)
+        DPRINTF_OPTIONAL(fd, counters[i].name, read_counter(counters[i].fd));
+    DPRINTF(fd, "\"waits\":%ld,", rusage.ru_nvcsw);
+    DPRINTF(fd, "\"preemptions\":%ld,", rusage.ru_nivcsw);
+    DPRINTF(fd, "\"spawn_latency\":%lld,", first_spawn_latency);
+    if (phases_marked) {
+        DPRINTF(fd, "%s", "\"phases\":");
+        if (print_phases(fd) != 0)
+            return 1;
+        DPRINTF(fd, "%s", ",");
+    } else
+        DPRINTF(fd, "%s", "\"phases\":null,");
+    if (timeline_interval_ns != 0) {
+        DPRINTF(fd, "%s", "\"timeline\":");
+        if (print_timeline(fd) != 0)
+            return 1;
+        DPRINTF(fd, "%s", ",");
+    } else
+        DPRINTF(fd, "%s", "\"timeline\":null,");
+    if (warmup_runs + runs > 1) {
+        DPRINTF(fd, "\"run_statistics\":{\"runs\":%d,\"warmup_runs\":%d", measured_runs, warmup_runs);
+        for (int field = 0; field < RUN_FIELDS; field++) {
+            DPRINTF(fd, "%s", ",");
+            if (print_statistics(fd, usage_field_names[field], run_usage[field], measured_runs) != 0)
+                return 1;
+        }
+        DPRINTF(fd, "%s", ",");
+        if (print_statistics(fd, "spawn_latency", spawn_latencies, measured_runs) != 0)
+            return 1;
+        DPRINTF(fd, "%s", "}");
+    } else
+        DPRINTF(fd, "%s", "\"run_statistics\":null");
+    if (launcher_start != 0) {
+        DPRINTF(fd, "%s", ",\"trace\":");
+        if (print_trace(fd) != 0)
+            return 1;
+    } else
+        DPRINTF(fd, "%s", ",\"trace\":null");
+    DPRINTF(fd, "%s\n", "}");
+
+    if (profile_fd >= 0 && write_profile(profile_fd) != 0)
+        return 1;
+
+    return 0;
 }
@@ -1,3 +1,14 @@
+/* yargs -- execute a program with extra arguments spliced in from files of null-terminated strings
+
+   Usage: yargs MARKER[?]=FILE [MARKER[?]=FILE...] [--] PROGRAM [ARGS...]
+      or: yargs MARKER FILE PROGRAM [ARGS...]
+
+   The first argument equal to each MARKER is replaced by the arguments in the corresponding FILE. With MARKER?=FILE,
+   a missing FILE counts as empty, like the engine's %/FILE, for options that a language's cache may provide. Doing all
+   the substitutions in one go saves chaining several yargs processes, each with its own exec. The files are mapped
+   rather than read, and the arguments are counted before the argument array is allocated, so large files cost one pass
+   over their contents and no copying.  */
+
 #include <errno.h>
 #include <fcntl.h>
 #include <unistd.h>
@@ -5,86 +16,144 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 
-#define ARGS_BUFFER_SIZE 10
-#define FILE_BUFFER_SIZE 4096
-
-#define APPEND(ptr) do { \
-    if (args_length >= args_buffer_size) { /* needs realloc */ \
-        args_buffer_size += ARGS_BUFFER_SIZE * sizeof ptr; \
-        args_buffer = realloc(args_buffer, args_buffer_size); \
-        if (args_buffer == NULL) { \
-            perror("malloc"); \
-            return 1; \
-        }; \
-    }; \
-    args_buffer[args_length] = (ptr); \
-    args_length++; \
-} while (0)
+struct substitution {
+    char * marker;
+    char * file_name;
+    char * file_buf;
+    size_t file_size;
+    size_t arg_count;
+    bool optional;
+    bool replaced;
+};
 
-int main(int argc, char * argv []) {
-    if (argc < 4) {
-        fprintf(stderr, "%s\n", "yargs: too few arguments");
-        return 1;
+// map the whole of the file into substitution->file_buf, and count the arguments in it
+int map_substitution(struct substitution * substitution) {
+    int fd = openat(AT_FDCWD, substitution->file_name, O_RDONLY | O_CLOEXEC);
+    if (fd < 0 && errno == ENOENT && substitution->optional) {
+        return 0;
     };
-    char * replace_string = argv[1];
-    char * file_name = argv[2];
-    char * program = argv[3];
-    int fd = openat(AT_FDCWD, file_name, O_CLOEXEC);
     if (fd < 0) {
         perror("yargs: openat");
+        return -1;
+    };
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        perror("yargs: fstat");
+        return -1;
+    };
+    substitution->file_size = st.st_size;
+    if (substitution->file_size != 0) {
+        // the file is only read, and the mapping lasts until the exec, so the arguments can point straight into it
+        substitution->file_buf = mmap(NULL, substitution->file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (substitution->file_buf == MAP_FAILED) {
+            perror("yargs: mmap");
+            return -1;
+        };
+    };
+    close(fd);
+    char * end = substitution->file_buf + substitution->file_size;
+    for (char * p = substitution->file_buf; p < end; p++) {
+        p = memchr(p, 0, end - p);
+        if (p == NULL) {
+            // the last string is ignored
+            fprintf(stderr, "%s\n", "yargs: string was not null-terminated!");
+            break;
+        };
+        substitution->arg_count++;
+    };
+    return 0;
+};
+
+int main(int argc, char * argv []) {
+    struct substitution * substitutions = calloc(argc, sizeof *substitutions);
+    if (substitutions == NULL) {
+        perror("yargs: malloc");
         return 1;
     };
-    char * file_buf = NULL;
-    size_t file_size = 0;
-    while (true) {
-        file_buf = realloc(file_buf, file_size + FILE_BUFFER_SIZE);
-        if (file_buf == NULL) {
-            perror("yargs: malloc");
+    size_t substitution_count = 0;
+    int i = 1;
+    if (argc >= 2 && strchr(argv[1], '=') == NULL) {
+        // original form, with a single substitution
+        if (argc < 4) {
+            fprintf(stderr, "%s\n", "yargs: too few arguments");
             return 1;
         };
-        ssize_t n = read(fd, file_buf, FILE_BUFFER_SIZE);
-        if (n == 0) {
-            // EOF
-            break;
-        } else if (n < 0) {
-            perror("yargs: read");
+        substitutions[0].marker = argv[1];
+        substitutions[0].file_name = argv[2];
+        substitution_count = 1;
+        i = 3;
+    } else {
+        for (; i < argc; i++) {
+            if (strcmp(argv[i], "--") == 0) {
+                i++;
+                break;
+            };
+            char * separator = strchr(argv[i], '=');
+            if (separator == NULL) {
+                break;
+            };
+            *separator = 0;
+            if (separator > argv[i] && separator[-1] == '?') {
+                separator[-1] = 0;
+                substitutions[substitution_count].optional = true;
+            };
+            substitutions[substitution_count].marker = argv[i];
+            substitutions[substitution_count].file_name = separator + 1;
+            substitution_count++;
+        };
+    };
+    if (i >= argc) {
+        fprintf(stderr, "%s\n", "yargs: too few arguments");
+        return 1;
+    };
+    // the program and its arguments, plus the terminating null pointer
+    size_t args_buffer_size = argc - i + 1;
+    for (size_t s = 0; s < substitution_count; s++) {
+        if (map_substitution(&substitutions[s]) < 0) {
             return 1;
-        } else {
-            file_size += n;
         };
+        args_buffer_size += substitutions[s].arg_count;
+    };
+
+    char * program = argv[i];
+    char * * args_buffer = malloc(args_buffer_size * sizeof *args_buffer);
+    if (args_buffer == NULL) {
+        perror("yargs: malloc");
+        return 1;
     };
-    char * * args_buffer = NULL;
-    size_t args_buffer_size = 0;
     size_t args_length = 0;
-    bool replaced = false;
-    APPEND(program);
-    for (size_t i = 4; i < argc; i++) {
-        if (!replaced && strcmp(argv[i], replace_string) == 0) {
-            replaced = true;
-            size_t arg = 0;
-            size_t j;
-            for (j = 0; j < file_size; j++) {
-                if (file_buf[j] == 0) {
-                    // null-termination = end of string
-                    APPEND(file_buf + arg);
-                    arg = j + 1;
-                };
+    args_buffer[args_length++] = program;
+    for (i++; i < argc; i++) {
+        struct substitution * substitution = NULL;
+        for (size_t s = 0; s < substitution_count; s++) {
+            if (!substitutions[s].replaced && strcmp(argv[i], substitutions[s].marker) == 0) {
+                substitution = &substitutions[s];
+                break;
+            };
+        };
+        if (substitution != NULL) {
+            substitution->replaced = true;
+            char * arg = substitution->file_buf;
+            for (size_t n = 0; n < substitution->arg_count; n++) {
+                args_buffer[args_length++] = arg;
+                // null-termination = end of string
+                arg = (char *)memchr(arg, 0, substitution->file_buf + substitution->file_size - arg) + 1;
             };
-            if (file_size != 0 && file_buf[j] != 0) {
-                fprintf(stderr, "%s\n", "yargs: string was not null-terminated!");
-            };    
         } else {
-            APPEND(argv[i]);
+            args_buffer[args_length++] = argv[i];
         };
     };
-    if (!replaced) {
-        fprintf(stderr, "%s\n", "yargs: warning: no replacement string was found");
+    for (size_t s = 0; s < substitution_count; s++) {
+        if (!substitutions[s].replaced) {
+            fprintf(stderr, "yargs: warning: replacement string %s was not found\n", substitutions[s].marker);
+        };
     };
     // execv requires a null pointer to terminate the argument array
-    APPEND(NULL);
+    args_buffer[args_length++] = NULL;
     execvp(program, args_buffer);
     // shouldn't reach this point if execvp succeeds
     perror("yargs: execvp");